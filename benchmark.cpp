@@ -0,0 +1,87 @@
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "utils.hpp"
+#include "youdis/benchmark.hpp"
+
+namespace {
+void report(const char* name, const resp::Histogram& h, double seconds) {
+  auto us = [](uint64_t ns) { return ns / 1000.0; };
+  printf("%-6s %10llu %12.0f %9.1f %9.1f %9.1f %9.1f %9.1f\n", name,
+         static_cast<unsigned long long>(h.count()), h.count() / seconds,
+         us(h.mean()), us(h.percentile(50)), us(h.percentile(99)),
+         us(h.percentile(99.9)), us(h.max()));
+}
+}  // namespace
+
+// drives a running server with the configured load and prints throughput
+// and latency percentiles per command.
+int main(int argc, char** argv) {
+  try {
+    auto config = resp::BenchmarkConfig::parse(argc, argv);
+    std::vector<std::unique_ptr<resp::Benchmark>> benchmarks;
+    for (int i = 0; i < config.threads; ++i) {
+      // the first threads take the remainders.
+      int clients = config.clients / config.threads +
+                    (i < config.clients % config.threads);
+      uint64_t requests = config.requests / config.threads +
+                          (uint64_t(i) < config.requests % config.threads);
+      benchmarks.push_back(
+          std::make_unique<resp::Benchmark>(config, clients, requests));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (auto& b : benchmarks) {
+      threads.emplace_back([&b]() {
+        try {
+          b->run();
+        } catch (const std::exception& e) {
+          error() << e.what() << std::endl;
+          std::terminate();
+        }
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+            .count();
+
+    printf("%d clients, %d threads, pipeline %d, keyspace %llu, values of "
+           "%zu bytes\n",
+           config.clients, config.threads, config.pipeline,
+           static_cast<unsigned long long>(config.keyspace),
+           config.valueSize);
+    printf("%-6s %10s %12s %9s %9s %9s %9s %9s\n", "", "requests", "ops/sec",
+           "mean us", "p50 us", "p99 us", "p99.9 us", "max us");
+    resp::Histogram all;
+    uint64_t errors = 0;
+    for (size_t op = 0; op < config.mix.size(); ++op) {
+      resp::Histogram h;
+      for (auto& b : benchmarks) {
+        h.merge(b->latencies()[op]);
+      }
+      if (h.count() > 0) {
+        report(resp::BenchmarkConfig::NAMES[op], h, seconds);
+      }
+      all.merge(h);
+    }
+    for (auto& b : benchmarks) {
+      errors += b->failures();
+    }
+    report("ALL", all, seconds);
+    if (errors > 0) {
+      printf("%llu error replies\n", static_cast<unsigned long long>(errors));
+    }
+  } catch (const std::exception& e) {
+    error() << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -3,6 +3,7 @@
 #include <sys/epoll.h>
 #include <unistd.h>
 
+#include <cerrno>
 #include <cstring>
 #include <stdexcept>
 #include <vector>
@@ -62,6 +63,10 @@ class Epoll {
     int numEvents = epoll_wait(fd, events.data(),
                                static_cast<int>(events.size()), timeoutMs);
     if (numEvents == -1) {
+      // a signal handler ran, the caller simply polls again.
+      if (errno == EINTR) {
+        return 0;
+      }
       throw std::runtime_error("epoll wait error");
     }
     return numEvents;
@@ -1,12 +1,16 @@
 #pragma once
 
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <cerrno>
 #include <cstring>
 #include <iostream>
 #include <stdexcept>
+#include <string>
 #include <vector>
 
 class Socket {
@@ -32,9 +36,15 @@ class Socket {
 
   ~Socket() { close(fd); }
 
+  void reuse_address() {
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+  }
+
   void reuse_port() {
     int opt = 1;
     setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
   }
 
   auto raw_fd() -> int { return fd; }
@@ -57,11 +67,12 @@ class Socket {
     }
 
     if (bind(fd, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) == -1) {
-      throw std::runtime_error("failed to bind address.");
+      throw std::runtime_error(std::string("failed to bind address: ") +
+                               strerror(errno));
     }
   }
 
-  void listen_(int backlog = 10) {
+  void listen_(int backlog = 511) {
     if (listen(fd, backlog) == -1) {
       throw std::runtime_error("failed to listen.");
     }
@@ -76,6 +87,25 @@ class Socket {
     return cfd;
   }
 
+  // takes the next connection off the backlog as a non-blocking socket,
+  // returns -1 once the backlog is empty.
+  auto accept_nonblocking() -> int {
+    while (true) {
+      int cfd = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (cfd != -1) {
+        return cfd;
+      }
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return -1;
+      }
+      throw std::runtime_error(std::string("failed to accept client: ") +
+                               strerror(errno));
+    }
+  }
+
   void connect_(const char* address, int port) {
     sockaddr_in serverAddr;
     memset(&serverAddr, 0, sizeof(serverAddr));
@@ -112,6 +142,37 @@ class Socket {
     return buffer;
   }
 
+  // returns -1 when a non-blocking socket has nothing to read.
+  auto receive(char* buffer, size_t len, int flags = 0) -> ssize_t {
+    ssize_t bytesRead = recv(fd, buffer, len, flags);
+    if (bytesRead < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        return -1;
+      }
+      throw std::runtime_error("failed to receive.");
+    }
+    return bytesRead;
+  }
+
+  // returns -1 when a non-blocking socket cannot take more data.
+  auto writev_(const iovec* iov, int count) -> ssize_t {
+    ssize_t sent = writev(fd, iov, count);
+    if (sent < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        return -1;
+      }
+      throw std::runtime_error("failed to send.");
+    }
+    return sent;
+  }
+
+  void set_nonblocking() {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+      throw std::runtime_error("failed to set socket non-blocking.");
+    }
+  }
+
   auto close_() -> bool {
     if (fd != -1) {
       close(fd);
@@ -0,0 +1,327 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <string>
+
+// a minimal io_uring on the raw syscalls: the submission and completion
+// rings plus one ring of provided receive buffers. queued sqes go to the
+// kernel together with the wait for completions, in a single syscall.
+class Uring {
+ public:
+  // entries sqes, and room for four times as many completions.
+  Uring(unsigned entries, uint16_t group_, unsigned bufferCount_,
+        unsigned bufferSize_)
+      : fd(-1),
+        group(group_),
+        bufferCount(bufferCount_),
+        bufferSize(bufferSize_),
+        bufferMask(bufferCount_ - 1) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER |
+                   IORING_SETUP_DEFER_TASKRUN;
+    params.cq_entries = entries * 4;
+    fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd == -1 && errno == EINVAL) {
+      // kernels before 6.1 know neither flag, task work then runs on its own.
+      params.flags = IORING_SETUP_CQSIZE;
+      fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    }
+    if (fd == -1) {
+      throw std::runtime_error(std::string("failed to set up io_uring: ") +
+                               strerror(errno));
+    }
+    if (!(params.features & IORING_FEAT_EXT_ARG) ||
+        !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+      close(fd);
+      throw std::runtime_error("io_uring lacks timed waits");
+    }
+    try {
+      map_rings(params);
+      setup_buffers();
+    } catch (...) {
+      release();
+      throw;
+    }
+  }
+
+  Uring(const Uring&) = delete;
+  Uring& operator=(const Uring&) = delete;
+
+  ~Uring() { release(); }
+
+  // a cleared sqe to fill in, submitting what is queued first when the ring
+  // is full. when the kernel takes none of it, busy with a full completion
+  // queue or short of memory, the sqe waits in the backlog, behind which the
+  // following ones queue up too so they stay in order.
+  auto get_sqe() -> io_uring_sqe* {
+    if (backlog.empty() && full()) {
+      enter(false, 0);
+    }
+    io_uring_sqe* sqe;
+    if (!backlog.empty() || full()) {
+      sqe = &backlog.emplace_back();
+    } else {
+      unsigned index = sqeTail & sqMask;
+      sqArray[index] = index;
+      ++sqeTail;
+      sqe = &sqes[index];
+    }
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+  }
+
+  // an accept that stays armed and completes once per connection.
+  void accept_multishot(int socket, uint64_t data) {
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = socket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = data;
+  }
+
+  // a recv that stays armed and completes once per arrival, with the data in
+  // a buffer picked from the provided ring.
+  void recv_multishot(int socket, uint64_t data) {
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = socket;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = group;
+    sqe->user_data = data;
+  }
+
+  // msg must stay valid until the completion arrives.
+  void sendmsg(int socket, const msghdr* msg, uint64_t data) {
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = socket;
+    sqe->addr = reinterpret_cast<uint64_t>(msg);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = data;
+  }
+
+  void cancel(uint64_t target, uint64_t data) {
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = target;
+    sqe->user_data = data;
+  }
+
+  // submits the queued sqes and waits up to timeoutMs for a completion, -1
+  // waits without a limit and 0 only collects what already finished.
+  void submit_and_wait(int timeoutMs) { enter(true, timeoutMs); }
+
+  // calls f(cqe) for every completion that arrived, then hands their slots
+  // back to the kernel.
+  template <class F>
+  auto for_each_cqe(F&& f) -> unsigned {
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    for (unsigned i = head; i != tail; ++i) {
+      f(static_cast<const io_uring_cqe&>(cqes[i & cqMask]));
+    }
+    __atomic_store_n(cqHead, tail, __ATOMIC_RELEASE);
+    return tail - head;
+  }
+
+  // the provided buffer a recv completion filled.
+  auto buffer(uint16_t id) -> const char* {
+    return buffers + size_t(id) * bufferSize;
+  }
+
+  // gives a provided buffer back to the kernel.
+  void recycle(uint16_t id) {
+    // not bufs[], which the kernel header declares in a way that c++ lays
+    // out 8 bytes further than c.
+    auto& slot =
+        reinterpret_cast<io_uring_buf*>(bufferRing)[bufferTail & bufferMask];
+    slot.addr = reinterpret_cast<uint64_t>(buffers + size_t(id) * bufferSize);
+    slot.len = bufferSize;
+    slot.bid = id;
+    ++bufferTail;
+    __atomic_store_n(&bufferRing->tail, bufferTail, __ATOMIC_RELEASE);
+  }
+
+  // io_uring_enter calls so far, the syscalls this backend makes besides
+  // closing connections.
+  auto syscalls() const -> uint64_t { return enters; }
+
+ private:
+  void release() {
+    if (buffers != nullptr) {
+      munmap(buffers, size_t(bufferCount) * bufferSize);
+    }
+    if (bufferRing != nullptr) {
+      munmap(bufferRing, bufferCount * sizeof(io_uring_buf));
+    }
+    if (sqes != nullptr) {
+      munmap(sqes, sqEntries * sizeof(io_uring_sqe));
+    }
+    if (ring != nullptr) {
+      munmap(ring, ringSize);
+    }
+    close(fd);
+  }
+
+  void map_rings(const io_uring_params& params) {
+    sqEntries = params.sq_entries;
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    ringSize = sqSize > cqSize ? sqSize : cqSize;
+    ring = map(ringSize, IORING_OFF_SQ_RING);
+    sqes = static_cast<io_uring_sqe*>(
+        map(params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES));
+
+    char* base = static_cast<char*>(ring);
+    sqHead = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+    cqHead = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+    sqeTail = *sqTail;
+  }
+
+  auto map(size_t len, off_t offset) -> void* {
+    void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, offset);
+    if (p == MAP_FAILED) {
+      throw std::runtime_error("failed to map io_uring rings");
+    }
+    return p;
+  }
+
+  void setup_buffers() {
+    size_t ringBytes = bufferCount * sizeof(io_uring_buf);
+    void* r = mmap(nullptr, ringBytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED) {
+      throw std::runtime_error("failed to allocate io_uring buffers");
+    }
+    bufferRing = static_cast<io_uring_buf_ring*>(r);
+    void* b = mmap(nullptr, size_t(bufferCount) * bufferSize,
+                   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b == MAP_FAILED) {
+      throw std::runtime_error("failed to allocate io_uring buffers");
+    }
+    buffers = static_cast<char*>(b);
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(bufferRing);
+    reg.ring_entries = bufferCount;
+    reg.bgid = group;
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg,
+                1) == -1) {
+      throw std::runtime_error(
+          std::string("failed to register io_uring buffers: ") +
+          strerror(errno));
+    }
+    bufferTail = 0;
+    for (unsigned i = 0; i < bufferCount; ++i) {
+      recycle(static_cast<uint16_t>(i));
+    }
+  }
+
+  // whether every sqe is handed out and not consumed by the kernel yet.
+  auto full() const -> bool {
+    return sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries;
+  }
+
+  // submits what is queued. with wait it also reaps finished work and waits
+  // for a completion, at most timeoutMs unless that is -1.
+  void enter(bool wait, int timeoutMs) {
+    while (!backlog.empty() && !full()) {
+      unsigned index = sqeTail & sqMask;
+      sqArray[index] = index;
+      ++sqeTail;
+      sqes[index] = backlog.front();
+      backlog.pop_front();
+    }
+    // what is still in the backlog goes in once the kernel consumed some,
+    // which it does on the next enter, so that one must not sleep.
+    if (!backlog.empty()) {
+      timeoutMs = 0;
+    }
+    __atomic_store_n(sqTail, sqeTail, __ATOMIC_RELEASE);
+    // everything the kernel has not consumed yet, including sqes an earlier
+    // call could not submit.
+    unsigned toSubmit = sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (!wait && toSubmit == 0) {
+      return;
+    }
+
+    unsigned flags = 0;
+    unsigned minComplete = 0;
+    io_uring_getevents_arg arg;
+    __kernel_timespec ts;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    if (wait) {
+      flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+      minComplete = timeoutMs == 0 ? 0 : 1;
+      if (timeoutMs > 0) {
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000ll;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+      }
+    }
+    ++enters;
+    long n = syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags,
+                     wait ? &arg : nullptr, wait ? sizeof(arg) : 0);
+    // running into the timeout, a signal or a full completion queue are all
+    // handled by looking at the completions.
+    if (n == -1 && errno != ETIME && errno != EINTR && errno != EBUSY &&
+        errno != EAGAIN) {
+      throw std::runtime_error(std::string("io_uring_enter failed: ") +
+                               strerror(errno));
+    }
+  }
+
+  int fd;
+  uint16_t group;
+  unsigned bufferCount;
+  unsigned bufferSize;
+  unsigned bufferMask;
+
+  void* ring = nullptr;
+  size_t ringSize = 0;
+  io_uring_sqe* sqes = nullptr;
+  unsigned sqEntries = 0;
+  unsigned* sqHead = nullptr;
+  unsigned* sqTail = nullptr;
+  unsigned sqMask = 0;
+  unsigned* sqArray = nullptr;
+  unsigned* cqHead = nullptr;
+  unsigned* cqTail = nullptr;
+  unsigned cqMask = 0;
+  io_uring_cqe* cqes = nullptr;
+  // sqes handed out so far.
+  unsigned sqeTail = 0;
+  // sqes that found the ring full, oldest first.
+  std::deque<io_uring_sqe> backlog;
+
+  io_uring_buf_ring* bufferRing = nullptr;
+  char* buffers = nullptr;
+  uint16_t bufferTail = 0;
+
+  uint64_t enters = 0;
+};
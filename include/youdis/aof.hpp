@@ -1,53 +1,532 @@
 #pragma once
 
-#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
 #include <functional>
+#include <initializer_list>
 #include <mutex>
-#include <ostream>
+#include <stdexcept>
 #include <string>
-#include <vector>
+#include <thread>
 
 #include "resp.hpp"
+#include "utils.hpp"
+#include "youdis/database.hpp"
 
 namespace resp {
+// the append only file. commands are appended to an in-memory buffer while
+// they execute and written out once per event loop iteration by flush(), so
+// all writes of an iteration share a single write() (group commit).
 class Aof {
  public:
-  Aof(const std::string& filepath_ = DEFAULT_NAME)
-      : filepath(filepath_) {}
+  enum class Fsync { ALWAYS, EVERYSEC, NO };
 
-  void save(const std::vector<char>& request) {
-    std::lock_guard<std::mutex> guard(mtx);
-    std::ofstream writer(filepath, std::ios::app);
-    writer.write(request.data(), request.size());
+  static auto instance() -> Aof& {
+    static Aof aof;
+    return aof;
+  }
+
+  static auto parse_fsync(const std::string& policy) -> Fsync {
+    if (policy == "always") {
+      return Fsync::ALWAYS;
+    }
+    if (policy == "everysec") {
+      return Fsync::EVERYSEC;
+    }
+    if (policy == "no") {
+      return Fsync::NO;
+    }
+    throw std::invalid_argument("invalid appendfsync policy " + policy);
+  }
+
+  Aof(const Aof&) = delete;
+  Aof& operator=(const Aof&) = delete;
+
+  ~Aof() {
+    {
+      std::lock_guard<std::mutex> guard(syncMtx);
+      closed = true;
+    }
+    syncCond.notify_all();
+    if (syncer.joinable()) {
+      syncer.join();
+    }
+    flush();
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+
+  // opens the file for appending, must be called before any save().
+  // rewritePercentage is the growth over the size after the last rewrite
+  // that triggers an automatic rewrite, 0 disables it.
+  void open(const std::string& filepath_, Fsync policy_,
+            int rewritePercentage_ = 0, size_t rewriteMinSize_ = 0) {
+    filepath = filepath_;
+    policy = policy_;
+    rewritePercentage = rewritePercentage_;
+    rewriteMinSize = rewriteMinSize_;
+    fd = ::open(filepath.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                0644);
+    if (fd == -1) {
+      throw std::runtime_error("failed to open aof " + filepath);
+    }
+    size = baseSize = file_size(fd);
+    if (policy == Fsync::EVERYSEC) {
+      syncer = std::thread([this]() { sync_every_second(); });
+    }
+  }
+
+  // appends a command to out in the resp wire format.
+  static void append_command(std::string& out,
+                             std::initializer_list<Slice> args) {
+    append_array(out, args.size());
+    for (auto arg : args) {
+      append_bulk(out, arg);
+    }
+  }
+
+  // the header of a command of n arguments, which append_bulk() follows.
+  static void append_array(std::string& out, size_t n) {
+    out += '*';
+    out += std::to_string(n);
+    out += "\r\n";
+  }
+
+  static void append_bulk(std::string& out, Slice arg) {
+    out += '$';
+    out += std::to_string(arg.size());
+    out += "\r\n";
+    out.append(arg.data(), arg.size());
+    out += "\r\n";
+  }
+
+  // whether open() was called, with appendonly off nothing is saved.
+  auto enabled() const -> bool { return fd != -1; }
+
+  auto rewrite_in_progress() -> bool {
+    std::lock_guard<std::mutex> guard(childMtx);
+    return child != -1;
+  }
+
+  // bytes in the file now, and after the last rewrite.
+  auto current_size() const -> size_t { return size; }
+
+  auto base_size() -> size_t {
+    std::lock_guard<std::mutex> guard(childMtx);
+    return baseSize;
   }
 
-  void load(std::function<void(Value& value)>&& f) {
-    std::vector<char> buf;
-    Parser parser(buf);
+  void save(Slice request) {
+    // what replay does to the dataset is already in the file.
+    if (fd == -1 || loading) {
+      return;
+    }
     std::lock_guard<std::mutex> guard(mtx);
-    std::ifstream reader(filepath);
-    char c;
-    while (true) {
-      buf.clear();
-      for (int i = 0; i < BUF_SIZE && reader.get(c); ++i) {
-        buf.push_back(c);
-      }
+    buf.append(request.data(), request.size());
+    if (rewriting) {
+      diff.append(request.data(), request.size());
+    }
+  }
+
+  // writes out everything saved so far, and fsyncs it under the always
+  // policy. called by every reactor at the end of its loop iteration, before
+  // the replies of that iteration are sent.
+  void flush() {
+    std::lock_guard<std::mutex> writing(writeMtx);
+    {
+      std::lock_guard<std::mutex> guard(mtx);
       if (buf.empty()) {
-        break;
+        return;
+      }
+      std::swap(buf, out);
+    }
+
+    size_t written = write_all(fd, out.data(), out.size());
+    if (written < out.size()) {
+      // keep the rest for the next flush rather than dropping it.
+      error() << "failed to write aof: " << strerror(errno) << std::endl;
+      std::lock_guard<std::mutex> guard(mtx);
+      buf.insert(0, out.data() + written, out.size() - written);
+    }
+    size += written;
+    out.clear();
+
+    if (policy == Fsync::ALWAYS) {
+      fdatasync(fd);
+    } else {
+      dirty = true;
+    }
+  }
+
+  // starts rewriting the aof from the current dataset in a forked child,
+  // returns false when a rewrite is already running. writes saved from the
+  // fork on are kept in a diff and appended to the new file when the child
+  // is done.
+  auto rewrite_background() -> bool {
+    std::lock_guard<std::mutex> guard(childMtx);
+    if (child != -1) {
+      return false;
+    }
+
+    // no write can be between applying and saving while every shard is
+    // locked, so the child sees exactly the writes that precede the diff.
+    std::string path = temp_path();
+    pid_t pid = Database::fork(
+        [this]() {
+          std::lock_guard<std::mutex> saving(mtx);
+          rewriting = true;
+          diff.clear();
+        },
+        [&path]() { return rewrite(path); });
+    if (pid == -1) {
+      error() << "failed to fork aof rewrite: " << strerror(errno)
+              << std::endl;
+      stop_rewriting();
+      retry_later();
+      return false;
+    }
+
+    child = pid;
+    info() << "background aof rewrite started by pid " << pid << std::endl;
+    return true;
+  }
+
+  // periodic work: reaps a finished rewrite and starts one automatically
+  // once the file has grown enough, though not within REWRITE_RETRY of a
+  // failed one.
+  void cron() {
+    if (fd == -1) {
+      return;
+    }
+    std::unique_lock<std::mutex> locker(childMtx);
+    if (child != -1) {
+      int status = 0;
+      if (waitpid(child, &status, WNOHANG) != child) {
+        return;
+      }
+      child = -1;
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        error() << "background aof rewrite failed" << std::endl;
+        stop_rewriting();
+        unlink(temp_path().c_str());
+        retry_later();
+      } else if (!finish_rewrite()) {
+        retry_later();
       }
+      return;
+    }
+
+    size_t current = size;
+    if (std::chrono::steady_clock::now() >= retryAt && rewritePercentage > 0 && current >= rewriteMinSize &&
+        current * 100 >= std::max<size_t>(baseSize, 1) *
+                             (100 + static_cast<size_t>(rewritePercentage))) {
+      locker.unlock();
+      info() << "aof grew from " << baseSize << " to " << current
+             << " bytes, rewriting" << std::endl;
+      rewrite_background();
+    }
+  }
 
-      parser.reset();
-      auto t = parser.parse();
-      f(*t);
+  // replays every command of the file through f, before any reactor runs.
+  // the file is mapped and parsed in place, so frames can have any size and
+  // nothing is copied. a frame cut short by a crash is dropped, together
+  // with the tail of the file.
+  void load(const std::function<void(const Request&)>& f) {
+    int rfd = ::open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (rfd == -1) {
+      return;
     }
+    size_t len = file_size(rfd);
+    if (len == 0) {
+      close(rfd);
+      return;
+    }
+    void* mapped = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, rfd, 0);
+    close(rfd);
+    if (mapped == MAP_FAILED) {
+      throw std::runtime_error("failed to map aof " + filepath);
+    }
+    madvise(mapped, len, MADV_SEQUENTIAL);
+
+    auto start = std::chrono::steady_clock::now();
+    const char* data = static_cast<const char*>(mapped);
+    size_t pos = 0;
+    size_t commands = 0;
+    Request request;
+    Arena arena;
+    loading = true;
+    try {
+      while (pos < len) {
+        arena.reset();
+        size_t n = RequestParser::parse(data + pos, len - pos, request, arena);
+        if (n == 0) {
+          break;
+        }
+        f(request);
+        pos += n;
+        ++commands;
+      }
+    } catch (const std::exception& e) {
+      loading = false;
+      munmap(mapped, len);
+      throw std::runtime_error("bad aof " + filepath + " at offset " +
+                               std::to_string(pos) + ": " + e.what());
+    }
+    loading = false;
+    munmap(mapped, len);
+
+    if (pos < len) {
+      error() << "aof " << filepath << " ends with a truncated command, "
+              << "dropping the last " << len - pos << " bytes" << std::endl;
+      if (truncate(filepath.c_str(), pos) == -1) {
+        throw std::runtime_error("failed to truncate aof " + filepath);
+      }
+      size = baseSize = pos;
+    }
+
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    seconds = std::max(seconds, 1e-9);
+    info() << "loaded aof " << filepath << ": " << commands << " commands, "
+           << pos << " bytes in " << seconds << "s ("
+           << pos / seconds / (1024 * 1024) << " MB/s, "
+           << static_cast<size_t>(commands / seconds) << " commands/s)"
+           << std::endl;
   }
 
  private:
-  static constexpr const char* DEFAULT_NAME = "database.aof";
-  static constexpr int BUF_SIZE = 1024;
+  static constexpr size_t REWRITE_CHUNK = 1 << 20;
+  // how long automatic rewrites wait after a failed one, as in redis.
+  static constexpr std::chrono::seconds REWRITE_RETRY{5};
+  // the most field value pairs a rewritten HSET carries, as in redis.
+  static constexpr size_t REWRITE_PAIRS = 64;
+
+  Aof()
+      : fd(-1),
+        policy(Fsync::EVERYSEC),
+        rewritePercentage(0),
+        rewriteMinSize(0),
+        size(0),
+        baseSize(0),
+        loading(false),
+        rewriting(false),
+        child(-1),
+        dirty(false),
+        closed(false) {}
+
+  static auto write_all(int fd, const char* data, size_t len) -> size_t {
+    size_t written = 0;
+    while (written < len) {
+      ssize_t n = write(fd, data + written, len - written);
+      if (n == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        break;
+      }
+      written += n;
+    }
+    return written;
+  }
+
+  static auto file_size(int fd) -> size_t {
+    struct stat st;
+    return fstat(fd, &st) == 0 ? st.st_size : 0;
+  }
+
+  auto temp_path() const -> std::string { return filepath + ".rewrite"; }
+
+  // runs in the forked child: writes the minimal commands that rebuild the
+  // dataset. no locks are taken, the child has its own frozen copy.
+  static auto rewrite(const std::string& path) -> bool {
+    int out = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out == -1) {
+      return false;
+    }
+    std::string chunk;
+    bool ok = true;
+    auto drain = [&](size_t threshold) {
+      if (ok && chunk.size() >= threshold) {
+        ok = write_all(out, chunk.data(), chunk.size()) == chunk.size();
+        chunk.clear();
+      }
+    };
+
+    Object::Digits digits;
+    int64_t now = Database::now();
+    for (auto& shard : Database::shards()) {
+      // keys past their deadline are left out, the others get theirs back
+      // after their values.
+      auto live = [&](const auto& entry) {
+        return !entry.flag || *shard.expires.find(entry.key()) > now;
+      };
+      shard.sets.for_each_entry([&](const auto& entry) {
+        if (live(entry)) {
+          append_command(chunk,
+                         {"SET", entry.key(), entry.value.view(digits)});
+          drain(REWRITE_CHUNK);
+        }
+      });
+      shard.hsets.for_each_entry([&](const auto& entry) {
+        if (!live(entry)) {
+          return;
+        }
+        // the fields go out REWRITE_PAIRS to a command.
+        size_t left = entry.value.size();
+        size_t pairs = 0;
+        entry.value.for_each([&](Slice field, Slice value) {
+          if (pairs == 0) {
+            pairs = std::min(left, REWRITE_PAIRS);
+            left -= pairs;
+            append_array(chunk, 2 + 2 * pairs);
+            append_bulk(chunk, "HSET");
+            append_bulk(chunk, entry.key());
+          }
+          append_bulk(chunk, field);
+          append_bulk(chunk, value);
+          --pairs;
+          drain(REWRITE_CHUNK);
+        });
+      });
+      shard.expires.for_each([&](Slice key, int64_t at) {
+        if (at > now) {
+          append_command(chunk, {"PEXPIREAT", key, Object::format(at, digits)});
+          drain(REWRITE_CHUNK);
+        }
+      });
+    }
+    drain(0);
+    ok = ok && fsync(out) == 0;
+    close(out);
+    return ok;
+  }
+
+  // appends the diff to the rewritten file and atomically puts it in place
+  // of the current one, returns whether it did. flushes are held off for the
+  // duration.
+  auto finish_rewrite() -> bool {
+    std::lock_guard<std::mutex> writing(writeMtx);
+    std::string path = temp_path();
+    int tfd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (tfd == -1) {
+      error() << "failed to open rewritten aof: " << strerror(errno)
+              << std::endl;
+      stop_rewriting();
+      return false;
+    }
+
+    // write the bulk of the diff without blocking saves, then the tail with
+    // saves stopped so nothing falls between the two files.
+    std::string pending;
+    bool ok = true;
+    while (ok) {
+      {
+        std::lock_guard<std::mutex> guard(mtx);
+        if (diff.size() < REWRITE_CHUNK) {
+          break;
+        }
+        std::swap(diff, pending);
+      }
+      ok = write_all(tfd, pending.data(), pending.size()) == pending.size();
+      pending.clear();
+    }
+
+    {
+      std::lock_guard<std::mutex> guard(mtx);
+      ok = ok && write_all(tfd, diff.data(), diff.size()) == diff.size() &&
+           fdatasync(tfd) == 0 && rename(path.c_str(), filepath.c_str()) == 0;
+      if (ok) {
+        // the descriptor number stays the same, so the fsync thread never
+        // sees a closed one. whatever was waiting for a flush is either in
+        // the child's dataset or in the diff.
+        dup2(tfd, fd);
+        buf.clear();
+        size = baseSize = file_size(fd);
+      }
+      rewriting = false;
+      diff.clear();
+      diff.shrink_to_fit();
+    }
+    close(tfd);
+
+    if (ok) {
+      info() << "background aof rewrite finished, " << size << " bytes"
+             << std::endl;
+    } else {
+      error() << "failed to finish aof rewrite: " << strerror(errno)
+              << std::endl;
+      unlink(path.c_str());
+    }
+    return ok;
+  }
+
+  // holds off automatic rewrites for a while, so a failing fork is not
+  // retried on every cron tick. the caller holds childMtx.
+  void retry_later() {
+    retryAt = std::chrono::steady_clock::now() + REWRITE_RETRY;
+  }
+
+  void stop_rewriting() {
+    std::lock_guard<std::mutex> guard(mtx);
+    rewriting = false;
+    diff.clear();
+  }
+
+  // the everysec policy: fsync in the background so the event loops never
+  // wait on the disk.
+  void sync_every_second() {
+    std::unique_lock<std::mutex> locker(syncMtx);
+    while (!closed) {
+      syncCond.wait_for(locker, std::chrono::seconds(1));
+      if (dirty.exchange(false)) {
+        fdatasync(fd);
+      }
+    }
+  }
 
   std::string filepath;
+  int fd;
+  Fsync policy;
+  int rewritePercentage;
+  size_t rewriteMinSize;
+
+  // bytes in the file, and after the last rewrite.
+  std::atomic<size_t> size;
+  size_t baseSize;
+  // set while load() replays the file.
+  bool loading;
+
+  // saved commands waiting for the next flush, and the batch being written.
+  std::string buf;
+  std::string out;
   std::mutex mtx;
+  std::mutex writeMtx;
+
+  // writes saved since the running rewrite forked.
+  bool rewriting;
+  std::string diff;
+  pid_t child;
+  std::mutex childMtx;
+  // no automatic rewrite starts before this.
+  std::chrono::steady_clock::time_point retryAt;
+
+  std::atomic<bool> dirty;
+  bool closed;
+  std::mutex syncMtx;
+  std::condition_variable syncCond;
+  std::thread syncer;
 };
 
 class AofParser {
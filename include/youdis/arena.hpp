@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace resp {
+// a bump allocator for temporaries that live until the end of one pipeline
+// batch. allocating is a pointer bump and reset() drops everything at once;
+// the memory is kept, and after a batch that needed more than one block the
+// blocks are merged into one, so steady state use never calls malloc. past
+// RETAIN_MAX the arena goes back to a single BLOCK_SIZE block instead, so a
+// spike does not pin its memory for good.
+class Arena {
+ public:
+  static constexpr size_t BLOCK_SIZE = 16 * 1024;
+  static constexpr size_t RETAIN_MAX = 1024 * 1024;
+
+  // the arena of the calling reactor thread, reset after every loop
+  // iteration.
+  static auto local() -> Arena& {
+    thread_local Arena arena;
+    return arena;
+  }
+
+  Arena() : used(0), total(0) {}
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  auto allocate(size_t size, size_t align = alignof(std::max_align_t))
+      -> void* {
+    if (!blocks.empty()) {
+      size_t offset = (used + align - 1) & ~(align - 1);
+      if (offset + size <= blocks.back().size) {
+        used = offset + size;
+        return blocks.back().data.get() + offset;
+      }
+    }
+    grow(size + align);
+    return allocate(size, align);
+  }
+
+  // uninitialized room for n trivially destructible T.
+  template <class T>
+  auto make_array(size_t n) -> T* {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "arena memory is never destructed");
+    return static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void reset() {
+    if (blocks.size() > 1 || total > RETAIN_MAX) {
+      blocks.clear();
+      grow(total > RETAIN_MAX ? BLOCK_SIZE : total);
+    }
+    used = 0;
+  }
+
+ private:
+  struct Block {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+
+  void grow(size_t atLeast) {
+    size_t size = BLOCK_SIZE;
+    while (size < atLeast) {
+      size <<= 1;
+    }
+    blocks.push_back({std::unique_ptr<char[]>(new char[size]), size});
+    total = blocks.size() == 1 ? size : total + size;
+    used = 0;
+  }
+
+  std::vector<Block> blocks;
+  // bytes used in the last block, and the size of all blocks.
+  size_t used;
+  size_t total;
+};
+};  // namespace resp
@@ -0,0 +1,367 @@
+#pragma once
+
+#include <sys/epoll.h>
+#include <sys/uio.h>
+
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "epoll.hpp"
+#include "socket.hpp"
+#include "youdis/buffer.hpp"
+#include "youdis/config.hpp"
+#include "youdis/histogram.hpp"
+#include "youdis/random.hpp"
+#include "youdis/resp.hpp"
+
+namespace resp {
+// the commands the benchmark can send.
+enum class Op { PING, SET, GET, HSET, HGET };
+
+struct BenchmarkConfig {
+  std::string host = "127.0.0.1";
+  int port = 6379;
+  // connections, spread evenly over the threads.
+  int clients = 50;
+  int threads = 1;
+  // requests each connection keeps in flight.
+  int pipeline = 1;
+  // total requests over all connections.
+  uint64_t requests = 100000;
+  // keys are drawn uniformly from this many. hash commands use keyspace
+  // fields spread over hashes of 100 fields each.
+  uint64_t keyspace = 100000;
+  size_t valueSize = 3;
+  // the weight of each command in the mix, in Op order.
+  std::array<int, 5> mix = {0, 1, 1, 0, 0};
+
+  static constexpr std::array<const char*, 5> NAMES = {"PING", "SET", "GET",
+                                                       "HSET", "HGET"};
+
+  // the load to generate, as given on the command line.
+  static auto parse(int argc, char** argv) -> BenchmarkConfig {
+    BenchmarkConfig config;
+    for_each_option(argc, argv, [&config](const std::string& name,
+                                          const std::string& value) {
+      if (name == "--host") {
+        config.host = value;
+      } else if (name == "--port") {
+        config.port = std::stoi(value);
+      } else if (name == "--clients") {
+        config.clients = positive(name, value);
+      } else if (name == "--threads") {
+        config.threads = positive(name, value);
+      } else if (name == "--pipeline") {
+        config.pipeline = positive(name, value);
+      } else if (name == "--requests") {
+        config.requests = positive(name, value);
+      } else if (name == "--keyspace") {
+        config.keyspace = positive(name, value);
+      } else if (name == "--value-size") {
+        config.valueSize = std::stoull(value);
+      } else if (name == "--mix") {
+        config.mix = parse_mix(value);
+      } else {
+        throw std::invalid_argument("unknown option " + name);
+      }
+    });
+    if (config.threads > config.clients) {
+      config.threads = config.clients;
+    }
+    return config;
+  }
+
+ private:
+  static auto positive(const std::string& name, const std::string& value)
+      -> long long {
+    long long n = std::stoll(value);
+    if (n <= 0) {
+      throw std::invalid_argument(name + " must be positive");
+    }
+    return n;
+  }
+
+  // a mix such as "get:9,set:1", a command without a weight counts once.
+  static auto parse_mix(const std::string& value) -> std::array<int, 5> {
+    std::array<int, 5> mix{};
+    size_t start = 0;
+    while (start <= value.size()) {
+      size_t end = value.find(',', start);
+      if (end == std::string::npos) {
+        end = value.size();
+      }
+      std::string item = value.substr(start, end - start);
+      size_t colon = item.find(':');
+      std::string name = item.substr(0, colon);
+      int weight = colon == std::string::npos
+                       ? 1
+                       : std::stoi(item.substr(colon + 1));
+      size_t op = 0;
+      while (op < NAMES.size() && !equals(name, NAMES[op])) {
+        ++op;
+      }
+      if (op == NAMES.size() || weight < 0) {
+        throw std::invalid_argument("invalid --mix entry " + item);
+      }
+      mix[op] += weight;
+      start = end + 1;
+    }
+    if (mix == std::array<int, 5>{}) {
+      throw std::invalid_argument("--mix has no commands");
+    }
+    return mix;
+  }
+
+  static auto equals(const std::string& s, const char* upperName) -> bool {
+    size_t i = 0;
+    for (; i < s.size() && upperName[i]; ++i) {
+      if (toupper(static_cast<unsigned char>(s[i])) != upperName[i]) {
+        return false;
+      }
+    }
+    return i == s.size() && upperName[i] == 0;
+  }
+};
+
+// one thread of the load generator: its share of the connections on an
+// epoll loop of its own. each connection keeps up to pipeline requests in
+// flight, refilled as replies arrive and written out together, and every
+// reply records the time since its request was written.
+class Benchmark {
+ public:
+  Benchmark(const BenchmarkConfig& config_, int clients, uint64_t requests_)
+      : config(config_),
+        requests(requests_),
+        value(config_.valueSize, 'x'),
+        events(64) {
+    for (size_t i = 0; i < config.mix.size(); ++i) {
+      for (int w = 0; w < config.mix[i]; ++w) {
+        ops.push_back(static_cast<Op>(i));
+      }
+    }
+    for (int i = 0; i < clients; ++i) {
+      auto c = std::make_unique<Connection>();
+      c->socket.create(AF_INET, SOCK_STREAM);
+      c->socket.connect_(config.host.c_str(), config.port);
+      c->socket.set_nonblocking();
+      c->inflight.resize(config.pipeline);
+      epoll.add_socket(c->socket.raw_fd(), EPOLLIN);
+      byFd.resize(std::max<size_t>(byFd.size(), c->socket.raw_fd() + 1));
+      byFd[c->socket.raw_fd()] = c.get();
+      connections.push_back(std::move(c));
+    }
+  }
+
+  void run() {
+    for (auto& c : connections) {
+      refill(*c);
+    }
+    while (done < requests) {
+      int n = epoll.wait(events, -1);
+      for (int i = 0; i < n; ++i) {
+        auto& c = *byFd[events[i].data.fd];
+        if (events[i].events & EPOLLOUT) {
+          flush(c);
+        }
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+          receive(c);
+          refill(c);
+        }
+      }
+    }
+  }
+
+  auto latencies() const -> const std::array<Histogram, 5>& {
+    return histograms;
+  }
+
+  auto failures() const -> uint64_t { return errors; }
+
+ private:
+  struct Sent {
+    Op op;
+    uint64_t at;
+  };
+
+  struct Connection {
+    Socket socket;
+    Buffer out;
+    std::string in;
+    // where the unparsed replies start in in.
+    size_t pos = 0;
+    // a ring of the requests waiting for their replies, oldest first.
+    std::vector<Sent> inflight;
+    size_t head = 0;
+    size_t pending = 0;
+    bool writing = false;
+  };
+
+  static auto now() -> uint64_t {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  // tops the connection up to pipeline requests in flight.
+  void refill(Connection& c) {
+    if (c.pending == c.inflight.size() || issued == requests) {
+      return;
+    }
+    uint64_t at = now();
+    while (c.pending < c.inflight.size() && issued < requests) {
+      Op op = ops[random64() % ops.size()];
+      append(c.out, op);
+      c.inflight[(c.head + c.pending) % c.inflight.size()] = Sent{op, at};
+      ++c.pending;
+      ++issued;
+    }
+    if (!c.writing) {
+      flush(c);
+    }
+  }
+
+  void append(Buffer& out, Op op) {
+    uint64_t r = random64() % config.keyspace;
+    char key[32];
+    char field[32];
+    if (op == Op::HSET || op == Op::HGET) {
+      snprintf(key, sizeof(key), "hash:%012llu",
+               static_cast<unsigned long long>(r / 100));
+      snprintf(field, sizeof(field), "field:%02llu",
+               static_cast<unsigned long long>(r % 100));
+    } else {
+      snprintf(key, sizeof(key), "key:%012llu",
+               static_cast<unsigned long long>(r));
+    }
+    switch (op) {
+      case Op::PING:
+        Serializer::array(out, 1);
+        Serializer::bulk(out, "PING");
+        break;
+      case Op::SET:
+        Serializer::array(out, 3);
+        Serializer::bulk(out, "SET");
+        Serializer::bulk(out, key);
+        Serializer::bulk(out, value);
+        break;
+      case Op::GET:
+        Serializer::array(out, 2);
+        Serializer::bulk(out, "GET");
+        Serializer::bulk(out, key);
+        break;
+      case Op::HSET:
+        Serializer::array(out, 4);
+        Serializer::bulk(out, "HSET");
+        Serializer::bulk(out, key);
+        Serializer::bulk(out, field);
+        Serializer::bulk(out, value);
+        break;
+      case Op::HGET:
+        Serializer::array(out, 3);
+        Serializer::bulk(out, "HGET");
+        Serializer::bulk(out, key);
+        Serializer::bulk(out, field);
+        break;
+    }
+  }
+
+  void flush(Connection& c) {
+    iovec iov[16];
+    while (!c.out.empty()) {
+      ssize_t n = c.socket.writev_(iov, c.out.peek(iov, 16));
+      if (n == -1) {
+        break;
+      }
+      c.out.consume(n);
+    }
+    // wait for room only while something is left over.
+    if (c.writing != !c.out.empty()) {
+      c.writing = !c.out.empty();
+      epoll.modify_socket(c.socket.raw_fd(),
+                          c.writing ? EPOLLIN | EPOLLOUT : EPOLLIN);
+    }
+  }
+
+  void receive(Connection& c) {
+    while (true) {
+      size_t size = c.in.size();
+      c.in.resize(size + 64 * 1024);
+      ssize_t n = c.socket.receive(&c.in[size], 64 * 1024);
+      c.in.resize(size + std::max<ssize_t>(n, 0));
+      if (n == 0) {
+        throw std::runtime_error("server closed the connection.");
+      }
+      if (n == -1) {
+        break;
+      }
+    }
+    uint64_t at = now();
+    while (c.pending > 0) {
+      const char* start = c.in.data() + c.pos;
+      const char* end = reply_end(start, c.in.data() + c.in.size());
+      if (end == nullptr) {
+        break;
+      }
+      errors += *start == '-';
+      auto& sent = c.inflight[c.head];
+      histograms[static_cast<size_t>(sent.op)].record(at - sent.at);
+      c.head = (c.head + 1) % c.inflight.size();
+      --c.pending;
+      ++done;
+      c.pos = end - c.in.data();
+    }
+    c.in.erase(0, c.pos);
+    c.pos = 0;
+  }
+
+  // the end of the reply starting at p, nullptr while it is incomplete.
+  static auto reply_end(const char* p, const char* end) -> const char* {
+    if (p == end) {
+      return nullptr;
+    }
+    char type = *p;
+    const char* line = p + 1;
+    while (line + 1 < end && !(line[0] == '\r' && line[1] == '\n')) {
+      ++line;
+    }
+    if (line + 1 >= end) {
+      return nullptr;
+    }
+    const char* next = line + 2;
+    if (type != types::BULK && type != types::ARRAY) {
+      return next;
+    }
+    long long n = std::strtoll(p + 1, nullptr, 10);
+    if (type == types::BULK) {
+      return n < 0 ? next : end - next >= n + 2 ? next + n + 2 : nullptr;
+    }
+    for (long long i = 0; i < n && next != nullptr; ++i) {
+      next = reply_end(next, end);
+    }
+    return next;
+  }
+
+  const BenchmarkConfig& config;
+  uint64_t requests;
+  std::string value;
+  // the mix expanded by weight, drawn from uniformly.
+  std::vector<Op> ops;
+  Epoll epoll;
+  std::vector<epoll_event> events;
+  std::vector<std::unique_ptr<Connection>> connections;
+  std::vector<Connection*> byFd;
+  uint64_t issued = 0;
+  uint64_t done = 0;
+  uint64_t errors = 0;
+  std::array<Histogram, 5> histograms;
+};
+};  // namespace resp
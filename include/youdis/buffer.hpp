@@ -0,0 +1,87 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <deque>
+#include <string_view>
+#include <vector>
+
+namespace resp {
+// a growable output buffer made of chunks: small writes are packed into
+// CHUNK_SIZE chunks, large ones get a chunk of their own so they are never
+// moved again once appended. the last chunk is kept when everything has
+// been consumed, so a buffer in steady use does not allocate.
+class Buffer {
+ public:
+  static constexpr size_t CHUNK_SIZE = 16 * 1024;
+
+  void append(const char* data, size_t len) {
+    bytes += len;
+    if (len >= CHUNK_SIZE) {
+      chunks.emplace_back(data, data + len);
+      return;
+    }
+    auto& tail = writable(len);
+    tail.insert(tail.end(), data, data + len);
+  }
+
+  void append(std::string_view s) { append(s.data(), s.size()); }
+
+  void append(char c) {
+    ++bytes;
+    writable(1).push_back(c);
+  }
+
+  // the number of bytes appended and not consumed yet.
+  auto size() const -> size_t { return bytes; }
+  auto empty() const -> bool { return bytes == 0; }
+
+  // points iov at up to max pieces of the pending data, returns how many.
+  auto peek(iovec* iov, int max) -> int {
+    int count = 0;
+    size_t skip = sent;
+    for (auto it = chunks.begin(); it != chunks.end() && count < max; ++it) {
+      if (it->size() == skip) {
+        break;
+      }
+      iov[count].iov_base = it->data() + skip;
+      iov[count].iov_len = it->size() - skip;
+      ++count;
+      skip = 0;
+    }
+    return count;
+  }
+
+  // drops the first n pending bytes.
+  void consume(size_t n) {
+    bytes -= n;
+    sent += n;
+    while (!chunks.empty() && sent >= chunks.front().size()) {
+      if (chunks.size() == 1 && chunks.front().capacity() == CHUNK_SIZE) {
+        chunks.front().clear();
+        sent = 0;
+        return;
+      }
+      sent -= chunks.front().size();
+      chunks.pop_front();
+    }
+  }
+
+  void clear() { consume(bytes); }
+
+ private:
+  auto writable(size_t len) -> std::vector<char>& {
+    if (chunks.empty() ||
+        chunks.back().capacity() - chunks.back().size() < len) {
+      chunks.emplace_back();
+      chunks.back().reserve(CHUNK_SIZE);
+    }
+    return chunks.back();
+  }
+
+  std::deque<std::vector<char>> chunks;
+  // how much of the first chunk was consumed.
+  size_t sent = 0;
+  size_t bytes = 0;
+};
+};  // namespace resp
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <cstring>
+#include <vector>
+
+#include "socket.hpp"
+#include "youdis/buffer.hpp"
+#include "youdis/resp.hpp"
+#include "youdis/socket_readable.hpp"
+#include "youdis/stats.hpp"
+
+namespace resp {
+// per-connection state that outlives a single epoll event: the query buffer
+// keeps whatever the client sent that has not been parsed yet, so pipelined
+// requests and frames split across reads are not lost. fd must already be
+// non-blocking. queryLimit caps the unparsed bytes a client may leave in
+// the query buffer.
+class Client {
+ public:
+  Client(int fd, size_t queryLimit_)
+      : socket(fd),
+        qpos(0),
+        qlen(0),
+        readSize(READ_MIN),
+        queryLimit(queryLimit_),
+        unread(false),
+        watchingOut(false) {}
+
+  Client(const Client&) = delete;
+  Client& operator=(const Client&) = delete;
+
+  Client(Client&&) = default;
+  Client& operator=(Client&&) = default;
+
+  auto raw_fd() -> int { return socket.raw_fd(); }
+
+  // appends what is available on the socket to the query buffer, up to
+  // READ_BUDGET bytes so one client cannot hold up the others on its
+  // thread. more() tells whether it stopped early. returns false once the
+  // peer closed its end, what arrived before is still there to parse.
+  auto read() -> bool {
+    compact();
+    size_t total = 0;
+    unread = false;
+    while (true) {
+      if (total >= READ_BUDGET) {
+        unread = true;
+        return true;
+      }
+      reserve(readSize);
+      ssize_t n = socket.receive(query.data() + qlen, readSize);
+      if (n > 0) {
+        qlen += n;
+        total += n;
+        Stats::bump(Stats::local().netInput, n);
+      }
+      if (n == 0) {
+        return false;
+      }
+      if (n < 0) {
+        return true;
+      }
+      // a read that filled the space hints at a large value or a deep
+      // pipeline, so the next one asks for more.
+      if (static_cast<size_t>(n) == readSize && readSize < READ_MAX) {
+        readSize *= 2;
+      }
+    }
+  }
+
+  // appends bytes that were received elsewhere, by an io_uring recv.
+  void feed(const char* data, size_t n) {
+    compact();
+    reserve(n);
+    memcpy(query.data() + qlen, data, n);
+    qlen += n;
+    Stats::bump(Stats::local().netInput, n);
+  }
+
+  // parses the next complete request from the query buffer into req, returns
+  // false when only a partial frame is left. the arguments of req point into
+  // the query buffer and are valid until the next read(), the argv array
+  // until the arena is reset.
+  auto next(Request& req, Arena& arena) -> bool {
+    size_t n =
+        RequestParser::parse(query.data() + qpos, qlen - qpos, req, arena);
+    qpos += n;
+    return n != 0;
+  }
+
+  // whether the last read() stopped on its budget, the socket may hold more
+  // that no new edge will announce.
+  auto more() const -> bool { return unread; }
+
+  // whether the unparsed bytes passed the query buffer limit, a frame that
+  // large is refused like redis does, by closing the client.
+  auto overflowed() const -> bool { return qlen - qpos > queryLimit; }
+
+  // replies are serialized in here and sent together by flush().
+  auto output() -> Buffer& { return out; }
+
+  auto pending() const -> bool { return !out.empty(); }
+
+  // whether the reactor waits for the socket to become writable.
+  auto watching() const -> bool { return watchingOut; }
+  void watch(bool on) { watchingOut = on; }
+
+  // writes out as much of the queued replies as the socket takes, a
+  // writev() at a time, returns whether everything was sent.
+  auto flush() -> bool {
+    while (!out.empty()) {
+      iovec iov[IOV_BATCH];
+      int count = out.peek(iov, IOV_BATCH);
+      ssize_t n = socket.writev_(iov, count);
+      if (n < 0) {
+        return false;
+      }
+      out.consume(n);
+      Stats::bump(Stats::local().netOutput, n);
+    }
+    return true;
+  }
+
+ private:
+  // drops the parsed prefix of the query buffer. a buffer that grew for a
+  // large request is given back once it was fully parsed.
+  void compact() {
+    if (qpos == 0) {
+      return;
+    }
+    if (qpos == qlen && query.size() > READ_MAX) {
+      std::vector<char>().swap(query);
+      readSize = READ_MIN;
+    } else {
+      memmove(query.data(), query.data() + qpos, qlen - qpos);
+    }
+    qlen -= qpos;
+    qpos = 0;
+  }
+
+  // makes room for n more bytes after the unparsed ones.
+  void reserve(size_t n) {
+    if (query.size() - qlen < n) {
+      query.resize(qlen + n);
+    }
+  }
+
+  Socket socket;
+
+  static constexpr size_t READ_MIN = 16 * 1024;
+  static constexpr size_t READ_MAX = 1024 * 1024;
+  static constexpr size_t READ_BUDGET = 4 * READ_MAX;
+
+  // query holds qlen bytes received so far, the first qpos of them parsed,
+  // the rest of it is room for the next read.
+  std::vector<char> query;
+  size_t qpos;
+  size_t qlen;
+  // how much the next recv asks for.
+  size_t readSize;
+  size_t queryLimit;
+  bool unread;
+
+  static constexpr int IOV_BATCH = 64;
+
+  Buffer out;
+  bool watchingOut;
+};
+};  // namespace resp
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cctype>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace resp {
+// calls f(name, value) for every "--name value" pair of the command line.
+template <class F>
+void for_each_option(int argc, char** argv, F&& f) {
+  for (int i = 1; i < argc; ++i) {
+    std::string name(argv[i]);
+    if (i + 1 >= argc) {
+      throw std::invalid_argument("missing value for " + name);
+    }
+    f(name, std::string(argv[++i]));
+  }
+}
+
+struct Config {
+  std::string bind = "127.0.0.1";
+  int port = 6379;
+  // the network backend, epoll or uring. uring falls back to epoll where
+  // the kernel lacks it.
+  std::string io = "epoll";
+  // length of the queue of connections waiting to be accepted, capped by
+  // net.core.somaxconn.
+  int tcpBacklog = 511;
+  // number of reactor threads, each runs its own event loop.
+  int threads = default_threads();
+  // a client whose unparsed input grows past this many bytes is closed.
+  size_t clientQueryBufferLimit = 1024 * 1024 * 1024;
+  // with appendonly the aof is written and replayed at startup, otherwise
+  // the dataset is loaded from the snapshot.
+  bool appendonly = true;
+  std::string appendfilename = "database.aof";
+  // always, everysec or no.
+  std::string appendfsync = "everysec";
+  // rewrite the aof once it grew by this percentage since the last rewrite
+  // and is at least the min size, 0 disables automatic rewrites.
+  int aofRewritePercentage = 100;
+  size_t aofRewriteMinSize = 64 * 1024 * 1024;
+  // written by SAVE and BGSAVE.
+  std::string dbfilename = "dump.ydb";
+  // limit for the dataset in bytes, 0 means none. once it is reached writes
+  // evict keys as the policy says, or are refused under noeviction.
+  size_t maxmemory = 0;
+  std::string maxmemoryPolicy = "noeviction";
+  // keys sampled per eviction, more is closer to exact lru/lfu.
+  int maxmemorySamples = 5;
+  // hashes stay a compact listpack up to this many fields and field or
+  // value length, past either they are converted to a hash table.
+  size_t hashMaxListpackEntries = 128;
+  size_t hashMaxListpackValue = 64;
+
+  // the server settings given on the command line.
+  static auto parse(int argc, char** argv) -> Config {
+    Config config;
+    for_each_option(argc, argv, [&config](const std::string& name,
+                                          const std::string& value) {
+      if (name == "--bind") {
+        config.bind = value;
+      } else if (name == "--port") {
+        config.port = std::stoi(value);
+      } else if (name == "--io") {
+        if (value != "epoll" && value != "uring") {
+          throw std::invalid_argument("--io must be epoll or uring");
+        }
+        config.io = value;
+      } else if (name == "--tcp-backlog") {
+        config.tcpBacklog = std::stoi(value);
+        if (config.tcpBacklog <= 0) {
+          throw std::invalid_argument("--tcp-backlog must be positive");
+        }
+      } else if (name == "--threads") {
+        config.threads = std::stoi(value);
+        if (config.threads <= 0) {
+          throw std::invalid_argument("--threads must be positive");
+        }
+      } else if (name == "--client-query-buffer-limit") {
+        config.clientQueryBufferLimit = bytes(name, value);
+      } else if (name == "--appendonly") {
+        config.appendonly = yes_no(name, value);
+      } else if (name == "--dbfilename") {
+        config.dbfilename = value;
+      } else if (name == "--appendfilename") {
+        config.appendfilename = value;
+      } else if (name == "--appendfsync") {
+        config.appendfsync = value;
+      } else if (name == "--auto-aof-rewrite-percentage") {
+        config.aofRewritePercentage = std::stoi(value);
+      } else if (name == "--auto-aof-rewrite-min-size") {
+        config.aofRewriteMinSize = std::stoull(value);
+      } else if (name == "--maxmemory") {
+        config.maxmemory = bytes(name, value);
+      } else if (name == "--maxmemory-policy") {
+        config.maxmemoryPolicy = value;
+      } else if (name == "--maxmemory-samples") {
+        config.maxmemorySamples = std::stoi(value);
+        if (config.maxmemorySamples <= 0) {
+          throw std::invalid_argument("--maxmemory-samples must be positive");
+        }
+      } else if (name == "--hash-max-listpack-entries") {
+        config.hashMaxListpackEntries = std::stoull(value);
+      } else if (name == "--hash-max-listpack-value") {
+        config.hashMaxListpackValue = std::stoull(value);
+      } else {
+        throw std::invalid_argument("unknown option " + name);
+      }
+    });
+    return config;
+  }
+
+ private:
+  static auto yes_no(const std::string& name, const std::string& value)
+      -> bool {
+    if (value != "yes" && value != "no") {
+      throw std::invalid_argument(name + " must be yes or no");
+    }
+    return value == "yes";
+  }
+
+  // a size such as 1048576, 512kb, 100mb or 2gb.
+  static auto bytes(const std::string& name, const std::string& value)
+      -> size_t {
+    size_t end = 0;
+    unsigned long long n = std::stoull(value, &end);
+    std::string unit;
+    for (size_t i = end; i < value.size(); ++i) {
+      unit += static_cast<char>(tolower(value[i]));
+    }
+    if (unit.empty() || unit == "b") {
+      return n;
+    }
+    if (unit == "kb") {
+      return n << 10;
+    }
+    if (unit == "mb") {
+      return n << 20;
+    }
+    if (unit == "gb") {
+      return n << 30;
+    }
+    throw std::invalid_argument(name + " has an invalid unit");
+  }
+
+  static auto default_threads() -> int {
+    int n = static_cast<int>(std::thread::hardware_concurrency());
+    return n > 0 ? n : 1;
+  }
+};
+};  // namespace resp
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+
+#include "youdis/aof.hpp"
+#include "youdis/database.hpp"
+#include "youdis/eviction.hpp"
+#include "youdis/expiration.hpp"
+#include "youdis/snapshot.hpp"
+#include "youdis/stats.hpp"
+
+namespace resp {
+// the timed work a reactor thread does between events, whatever its i/o
+// backend. each thread takes care of its own share of the keyspace shards,
+// id, id + count, ...
+class Cron {
+ public:
+  Cron(int id_, int count_)
+      : id(id_),
+        count(count_),
+        nextCron(std::chrono::steady_clock::now()),
+        nextExpire(nextCron) {}
+
+  // milliseconds until the next job is due, the longest the loop may sleep.
+  // rounded up so the loop does not wake just before it.
+  auto timeout() const -> int {
+    auto left =
+        std::min(nextCron, nextExpire) - std::chrono::steady_clock::now();
+    if (left <= left.zero()) {
+      return 0;
+    }
+    return static_cast<int>(
+        std::chrono::ceil<std::chrono::milliseconds>(left).count());
+  }
+
+  // runs what is due, called once per loop iteration.
+  void run() {
+    auto now = std::chrono::steady_clock::now();
+    Eviction::instance().tick(now);
+    // active expiry runs every cron interval, and right again while it
+    // keeps running out of budget, so a burst of expiring keys is worked
+    // off in small slices instead of one long pause.
+    if (now >= nextExpire) {
+      bool behind = Expiration::instance().cycle(
+          id, count, std::chrono::microseconds(EXPIRE_BUDGET_US));
+      nextExpire = now + std::chrono::milliseconds(
+                             behind ? EXPIRE_RETRY_MS : CRON_INTERVAL_MS);
+    }
+    if (now >= nextCron) {
+      Database::rehash(id, count, std::chrono::milliseconds(1));
+      if (id == 0) {
+        Aof::instance().cron();
+        Snapshot::instance().cron();
+        Stats::instance().sample(now);
+      }
+      nextCron = now + std::chrono::milliseconds(CRON_INTERVAL_MS);
+    }
+  }
+
+ private:
+  static constexpr int CRON_INTERVAL_MS = 100;
+  // an active expiry cycle that ran out of budget goes on after
+  // EXPIRE_RETRY_MS, so it takes at most a quarter of the thread meanwhile.
+  static constexpr int EXPIRE_BUDGET_US = 250;
+  static constexpr int EXPIRE_RETRY_MS = 1;
+
+  int id;
+  int count;
+  std::chrono::steady_clock::time_point nextCron;
+  std::chrono::steady_clock::time_point nextExpire;
+};
+};  // namespace resp
@@ -1,29 +1,155 @@
 #pragma once
 
+#include <unistd.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <mutex>
+#include <shared_mutex>
 #include <string>
-#include <unordered_map>
-#include <utility>
+#include <string_view>
+
+#include "youdis/dict.hpp"
+#include "youdis/hash.hpp"
+#include "youdis/object.hpp"
 
 namespace resp {
+// the keyspace is split into SHARDS partitions by key hash, each with its own
+// maps and reader/writer lock, so commands on different shards never contend
+// and reads of the same shard run in parallel.
 class Database {
  public:
-  static auto sets()
-      -> std::pair<std::unordered_map<std::string, std::string>&, std::mutex&> {
-    static std::unordered_map<std::string, std::string> m;
-    static std::mutex mtx;
-    return {m, mtx};
-  }
-
-  static auto hsets() -> std::pair<
-      std::unordered_map<std::string,
-                         std::unordered_map<std::string, std::string>>&,
-      std::mutex&> {
-    static std::unordered_map<std::string,
-                              std::unordered_map<std::string, std::string>>
-        m;
-    static std::mutex mtx;
-    return {m, mtx};
+  static constexpr size_t SHARD_BITS = 6;
+  static constexpr size_t SHARDS = size_t(1) << SHARD_BITS;
+
+  struct Shard {
+    std::shared_mutex mtx;
+    Dict<Object> sets;
+    Dict<Hash> hsets;
+    // the deadlines, in unix milliseconds, of the keys that have one. their
+    // entries in sets and hsets carry the flag bit, so keys without a ttl
+    // are never looked up here.
+    Dict<int64_t> expires;
+  };
+
+  // locks a set of shards, given as a bit mask, always in ascending shard
+  // order so that multi-key commands cannot deadlock each other.
+  class Guard {
+   public:
+    Guard(uint64_t mask_, bool exclusive_)
+        : mask(mask_), exclusive(exclusive_) {
+      for (uint64_t m = mask; m != 0; m &= m - 1) {
+        auto& mtx = shards()[__builtin_ctzll(m)].mtx;
+        exclusive ? mtx.lock() : mtx.lock_shared();
+      }
+    }
+
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+
+    ~Guard() {
+      for (uint64_t m = mask; m != 0; m &= m - 1) {
+        auto& mtx = shards()[__builtin_ctzll(m)].mtx;
+        exclusive ? mtx.unlock() : mtx.unlock_shared();
+      }
+    }
+
+   private:
+    uint64_t mask;
+    bool exclusive;
+  };
+
+  static auto shards() -> std::array<Shard, SHARDS>& {
+    static std::array<Shard, SHARDS> s;
+    return s;
+  }
+
+  // the top bits of the hash pick the shard, the dicts use the low ones.
+  static auto index(std::string_view key) -> size_t {
+    return hash(key) >> (64 - SHARD_BITS);
+  }
+
+  // the shard owning key, callers must hold its lock through a Guard.
+  static auto shard(std::string_view key) -> Shard& {
+    return shards()[index(key)];
+  }
+
+  // the same given h = hash(key).
+  static auto shard_of(uint64_t h) -> Shard& {
+    return shards()[h >> (64 - SHARD_BITS)];
+  }
+
+  static auto mask(std::string_view key) -> uint64_t {
+    return uint64_t(1) << index(key);
+  }
+
+  // unix time in milliseconds. key deadlines are absolute so they survive
+  // restarts.
+  static auto now() -> int64_t {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+  }
+
+  // removes key whatever its type, the shard must be locked exclusively.
+  static auto erase(Shard& shard, std::string_view key) -> bool {
+    bool erased = shard.sets.erase(key);
+    erased = shard.hsets.erase(key) || erased;
+    if (erased && !shard.expires.empty()) {
+      shard.expires.erase(key);
+    }
+    return erased;
+  }
+
+  // removes the hash under key and leaves a string of the same name alone,
+  // the deadline goes only when nothing is left under key.
+  static auto erase_hash(Shard& shard, std::string_view key) -> bool {
+    if (!shard.hsets.erase(key)) {
+      return false;
+    }
+    if (!shard.expires.empty() && shard.sets.find(key) == nullptr) {
+      shard.expires.erase(key);
+    }
+    return true;
+  }
+
+  // forks with every shard read-locked, so the child gets a consistent copy
+  // of the dataset that it reads without locking. before runs in the parent
+  // just ahead of the fork, the child runs work and exits with its result.
+  static auto fork(const std::function<void()>& before,
+                   const std::function<bool()>& work) -> pid_t {
+    Guard all(~uint64_t(0), false);
+    before();
+    pid_t pid = ::fork();
+    if (pid == 0) {
+      _exit(work() ? 0 : 1);
+    }
+    return pid;
+  }
+
+  // moves dict buckets of the shards first, first + stride, ... for at most
+  // budget, skipping shards that are busy.
+  static void rehash(size_t first, size_t stride,
+                     std::chrono::microseconds budget) {
+    auto deadline = std::chrono::steady_clock::now() + budget;
+    for (size_t i = first; i < SHARDS; i += stride) {
+      auto& shard = shards()[i];
+      std::unique_lock<std::shared_mutex> lock(shard.mtx, std::try_to_lock);
+      if (!lock.owns_lock()) {
+        continue;
+      }
+      auto now = std::chrono::steady_clock::now();
+      if (now >= deadline) {
+        return;
+      }
+      auto left = std::chrono::duration_cast<std::chrono::microseconds>(
+          deadline - now);
+      if (!shard.sets.rehash_for(left) && !shard.hsets.rehash_for(left)) {
+        shard.expires.rehash_for(left);
+      }
+    }
   }
 };
 };  // namespace resp
@@ -0,0 +1,415 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string_view>
+#include <utility>
+
+#include "youdis/memory.hpp"
+
+namespace resp {
+inline auto hash(std::string_view key) -> uint64_t {
+  return std::hash<std::string_view>{}(key);
+}
+
+// a chained hash table that grows and shrinks incrementally: when it needs
+// to resize, a second table is allocated and buckets are migrated a few at a
+// time on every write and from rehash() in idle time, so no single operation
+// pays for moving the whole table. entries keep their hash so migrations and
+// lookups rarely touch the keys. the key bytes live in the same allocation
+// right after the entry.
+template <class V>
+class Dict {
+ public:
+  struct Entry {
+    Entry* next;
+    uint64_t hash;
+    V value;
+    uint32_t keylen : 31;
+    // a bit free for the owner to mark entries with.
+    uint32_t flag : 1;
+    // free for the owner to track accesses in, fits in what would be
+    // padding. atomic because readers under a shared lock update it.
+    mutable std::atomic<uint32_t> clock;
+
+    auto key() const -> std::string_view {
+      return std::string_view(reinterpret_cast<const char*>(this + 1), keylen);
+    }
+  };
+
+  Dict() : rehashidx(-1) {}
+
+  Dict(const Dict&) = delete;
+  Dict& operator=(const Dict&) = delete;
+
+  ~Dict() { clear(); }
+
+  auto size() const -> size_t { return t[0].used + t[1].used; }
+  auto empty() const -> bool { return size() == 0; }
+  auto rehashing() const -> bool { return rehashidx >= 0; }
+
+  // lookups through a const Dict never move buckets, so they are safe under
+  // a shared lock.
+  auto find(std::string_view key) const -> const V* {
+    auto e = find_entry(key);
+    return e ? &e->value : nullptr;
+  }
+
+  auto find(std::string_view key) -> V* {
+    auto e = find_entry(key);
+    return e ? &e->value : nullptr;
+  }
+
+  auto find_entry(std::string_view key) const -> const Entry* {
+    return lookup(key, hash(key));
+  }
+
+  auto find_entry(std::string_view key) -> Entry* {
+    step();
+    return lookup(key, hash(key));
+  }
+
+  // the same with h = hash(key) already computed, for batches.
+  auto find(std::string_view key, uint64_t h) const -> const V* {
+    auto e = lookup(key, h);
+    return e ? &e->value : nullptr;
+  }
+
+  auto find_entry(std::string_view key, uint64_t h) const -> const Entry* {
+    return lookup(key, h);
+  }
+
+  // asks the cpu to load what a lookup of hash h reads first: the bucket
+  // slot, or with entry the first entry of the bucket, which reads the slot
+  // and so should come a while after the slot was prefetched. batches issue
+  // these for keys further down, so their cache misses overlap instead of
+  // adding up.
+  void prefetch(uint64_t h, bool entry) const {
+    for (int i = 0; i <= (rehashing() ? 1 : 0); ++i) {
+      if (t[i].size == 0) {
+        continue;
+      }
+      Entry* const* slot = &t[i].buckets[h & t[i].mask];
+      if (entry) {
+        __builtin_prefetch(*slot);
+      } else {
+        __builtin_prefetch(slot);
+      }
+    }
+  }
+
+  // returns the value of key, default constructing it when missing, and
+  // whether it was inserted.
+  auto insert(std::string_view key) -> std::pair<V*, bool> {
+    auto [e, inserted] = insert_entry(key);
+    return {&e->value, inserted};
+  }
+
+  auto insert_entry(std::string_view key) -> std::pair<Entry*, bool> {
+    return insert_entry(key, hash(key));
+  }
+
+  auto insert_entry(std::string_view key, uint64_t h)
+      -> std::pair<Entry*, bool> {
+    step();
+    if (auto e = lookup(key, h)) {
+      return {e, false};
+    }
+    expand_if_needed();
+
+    Table& dst = rehashing() ? t[1] : t[0];
+    auto e = make_entry(key, h);
+    link(dst, e);
+    return {e, true};
+  }
+
+  auto erase(std::string_view key) -> bool {
+    step();
+    uint64_t h = hash(key);
+    for (int i = 0; i <= (rehashing() ? 1 : 0); ++i) {
+      if (t[i].size == 0) {
+        continue;
+      }
+      for (Entry** p = &t[i].buckets[h & t[i].mask]; *p; p = &(*p)->next) {
+        Entry* e = *p;
+        if (e->hash == h && e->key() == key) {
+          *p = e->next;
+          destroy(e);
+          --t[i].used;
+          shrink_if_needed();
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  void clear() {
+    for (auto& table : t) {
+      for (size_t i = 0; i < table.size; ++i) {
+        for (Entry* e = table.buckets[i]; e;) {
+          Entry* next = e->next;
+          destroy(e);
+          e = next;
+        }
+      }
+      table.release();
+    }
+    rehashidx = -1;
+  }
+
+  // sizes an empty dict for n entries up front, for bulk loads.
+  void reserve(size_t n) {
+    if (!empty() || rehashing()) {
+      return;
+    }
+    t[0].release();
+    size_t target = INITIAL_SIZE;
+    while (target < n) {
+      target <<= 1;
+    }
+    t[0].allocate(target);
+  }
+
+  // migrates up to n buckets to the new table, returns whether the rehash is
+  // still in progress.
+  auto rehash(size_t n) -> bool {
+    if (!rehashing()) {
+      return false;
+    }
+    size_t emptyVisits = n * 10;
+    while (n-- > 0 && t[0].used != 0) {
+      while (t[0].buckets[rehashidx] == nullptr) {
+        ++rehashidx;
+        if (--emptyVisits == 0) {
+          return true;
+        }
+      }
+      for (Entry* e = t[0].buckets[rehashidx]; e;) {
+        Entry* next = e->next;
+        --t[0].used;
+        link(t[1], e);
+        e = next;
+      }
+      t[0].buckets[rehashidx++] = nullptr;
+    }
+    if (t[0].used != 0) {
+      return true;
+    }
+    t[0].release();
+    std::swap(t[0], t[1]);
+    rehashidx = -1;
+    return false;
+  }
+
+  // keeps rehashing for at most budget, returns whether work is left.
+  auto rehash_for(std::chrono::microseconds budget) -> bool {
+    auto deadline = std::chrono::steady_clock::now() + budget;
+    while (rehash(100)) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // calls f(entry) for up to n entries found from a random bucket on, so
+  // callers can pick among a few entries without walking the whole table.
+  template <class F>
+  void sample(uint64_t random, size_t n, F&& f) const {
+    if (empty()) {
+      return;
+    }
+    const Table& big = t[1].size > t[0].size ? t[1] : t[0];
+    size_t i = random & big.mask;
+    size_t visits = std::min(big.size, n * 20);
+    for (; n > 0 && visits > 0; --visits) {
+      for (auto& table : t) {
+        if (i >= table.size) {
+          continue;
+        }
+        for (Entry* e = table.buckets[i]; e && n > 0; e = e->next, --n) {
+          f(static_cast<const Entry&>(*e));
+        }
+      }
+      i = (i + 1) & big.mask;
+    }
+  }
+
+  // calls f(entry) for the entries of one bucket position and returns the
+  // cursor to continue from, 0 once the whole dict was visited. the cursor
+  // counts with its bits reversed, so after the table grew or shrank
+  // between calls it still names the buckets the entries not visited yet
+  // went to: every entry present for the whole scan is seen at least once,
+  // some may be seen twice. scanning never moves buckets, so it is safe
+  // under a shared lock.
+  template <class F>
+  auto scan(uint64_t cursor, F&& f) const -> uint64_t {
+    if (empty()) {
+      return 0;
+    }
+    auto visit = [&f](const Table& table, uint64_t v) {
+      for (Entry* e = table.buckets[v & table.mask]; e; e = e->next) {
+        f(static_cast<const Entry&>(*e));
+      }
+    };
+    if (!rehashing()) {
+      visit(t[0], cursor);
+      return next_cursor(cursor, t[0].mask);
+    }
+    // the small table's bucket, then every bucket of the large one it
+    // expands to.
+    const Table* small = &t[0];
+    const Table* large = &t[1];
+    if (small->size > large->size) {
+      std::swap(small, large);
+    }
+    visit(*small, cursor);
+    do {
+      visit(*large, cursor);
+      cursor = next_cursor(cursor, large->mask);
+    } while (cursor & (small->mask ^ large->mask));
+    return cursor;
+  }
+
+  // calls f(key, value) for every entry.
+  template <class F>
+  void for_each(F&& f) const {
+    for_each_entry([&f](const Entry& e) { f(e.key(), e.value); });
+  }
+
+  template <class F>
+  void for_each_entry(F&& f) const {
+    for (auto& table : t) {
+      for (size_t i = 0; i < table.size; ++i) {
+        for (Entry* e = table.buckets[i]; e; e = e->next) {
+          f(static_cast<const Entry&>(*e));
+        }
+      }
+    }
+  }
+
+ private:
+  static constexpr size_t INITIAL_SIZE = 4;
+
+  struct Table {
+    Entry** buckets = nullptr;
+    size_t size = 0;
+    size_t mask = 0;
+    size_t used = 0;
+
+    // calloc lets large tables come from fresh zero pages instead of being
+    // cleared up front.
+    void allocate(size_t n) {
+      buckets = static_cast<Entry**>(std::calloc(n, sizeof(Entry*)));
+      if (buckets == nullptr) {
+        throw std::bad_alloc();
+      }
+      Memory::allocated(buckets);
+      size = n;
+      mask = n - 1;
+      used = 0;
+    }
+
+    void release() {
+      if (buckets != nullptr) {
+        Memory::freed(buckets);
+      }
+      std::free(buckets);
+      *this = Table();
+    }
+  };
+
+  static auto make_entry(std::string_view key, uint64_t h) -> Entry* {
+    void* p = ::operator new(sizeof(Entry) + key.size());
+    auto len = static_cast<uint32_t>(key.size());
+    auto e = new (p) Entry{nullptr, h, V(), len, 0, {0}};
+    std::memcpy(reinterpret_cast<char*>(e + 1), key.data(), key.size());
+    Memory::allocated(e);
+    return e;
+  }
+
+  static void destroy(Entry* e) {
+    Memory::freed(e);
+    e->~Entry();
+    ::operator delete(e);
+  }
+
+  auto lookup(std::string_view key, uint64_t h) const -> Entry* {
+    for (int i = 0; i <= (rehashing() ? 1 : 0); ++i) {
+      if (t[i].size == 0) {
+        continue;
+      }
+      for (Entry* e = t[i].buckets[h & t[i].mask]; e; e = e->next) {
+        if (e->hash == h && e->key() == key) {
+          return e;
+        }
+      }
+    }
+    return nullptr;
+  }
+
+  // increments the bits of cursor under mask from the top down.
+  static auto next_cursor(uint64_t cursor, uint64_t mask) -> uint64_t {
+    cursor |= ~mask;
+    cursor = reverse(cursor);
+    ++cursor;
+    return reverse(cursor);
+  }
+
+  static auto reverse(uint64_t v) -> uint64_t {
+    v = ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
+    v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+    v = ((v >> 4) & 0x0f0f0f0f0f0f0f0full) | ((v & 0x0f0f0f0f0f0f0f0full) << 4);
+    return __builtin_bswap64(v);
+  }
+
+  static void link(Table& table, Entry* e) {
+    Entry*& head = table.buckets[e->hash & table.mask];
+    e->next = head;
+    head = e;
+    ++table.used;
+  }
+
+  void step() {
+    if (rehashing()) {
+      rehash(1);
+    }
+  }
+
+  void expand_if_needed() {
+    if (rehashing()) {
+      return;
+    }
+    if (t[0].size == 0) {
+      t[0].allocate(INITIAL_SIZE);
+    } else if (t[0].used >= t[0].size) {
+      start_rehash(t[0].used * 2);
+    }
+  }
+
+  void shrink_if_needed() {
+    if (!rehashing() && t[0].size > INITIAL_SIZE && t[0].used * 8 < t[0].size) {
+      start_rehash(t[0].used);
+    }
+  }
+
+  void start_rehash(size_t n) {
+    size_t target = INITIAL_SIZE;
+    while (target < n) {
+      target <<= 1;
+    }
+    t[1].allocate(target);
+    rehashidx = 0;
+  }
+
+  Table t[2];
+  long long rehashidx;
+};
+};  // namespace resp
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+
+#include "youdis/aof.hpp"
+#include "youdis/database.hpp"
+#include "youdis/memory.hpp"
+#include "youdis/random.hpp"
+
+namespace resp {
+// keeps the dataset within maxmemory by evicting keys before writes. instead
+// of a full lru list every key carries a 32 bit clock in its dict entry, and
+// a victim is picked among a few sampled keys. with lru the clock is the
+// last access time, with lfu it holds the time of the last decrement and a
+// logarithmic access counter that decays while the key goes unused. the
+// volatile policies only evict keys with a ttl, volatile-ttl the ones
+// closest to their deadline.
+class Eviction {
+ public:
+  enum class Policy {
+    NOEVICTION,
+    ALLKEYS_LRU,
+    ALLKEYS_LFU,
+    ALLKEYS_RANDOM,
+    VOLATILE_LRU,
+    VOLATILE_LFU,
+    VOLATILE_RANDOM,
+    VOLATILE_TTL,
+  };
+
+  static auto instance() -> Eviction& {
+    static Eviction eviction;
+    return eviction;
+  }
+
+  static auto parse_policy(const std::string& policy) -> Policy {
+    if (policy == "noeviction") {
+      return Policy::NOEVICTION;
+    }
+    if (policy == "allkeys-lru") {
+      return Policy::ALLKEYS_LRU;
+    }
+    if (policy == "allkeys-lfu") {
+      return Policy::ALLKEYS_LFU;
+    }
+    if (policy == "allkeys-random") {
+      return Policy::ALLKEYS_RANDOM;
+    }
+    if (policy == "volatile-lru") {
+      return Policy::VOLATILE_LRU;
+    }
+    if (policy == "volatile-lfu") {
+      return Policy::VOLATILE_LFU;
+    }
+    if (policy == "volatile-random") {
+      return Policy::VOLATILE_RANDOM;
+    }
+    if (policy == "volatile-ttl") {
+      return Policy::VOLATILE_TTL;
+    }
+    throw std::invalid_argument("invalid maxmemory policy " + policy);
+  }
+
+  // maxmemory 0 means no limit.
+  void configure(size_t maxmemory_, Policy policy_, int samples_) {
+    maxmemory = maxmemory_;
+    policy = policy_;
+    samples = samples_ > 0 ? samples_ : 1;
+    tick(std::chrono::steady_clock::now());
+  }
+
+  // advances the clocks, every reactor calls it once per loop iteration
+  // with the time it read anyway.
+  void tick(std::chrono::steady_clock::time_point now) {
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  now.time_since_epoch())
+                  .count();
+    advance(lruClock, static_cast<uint32_t>(ms / LRU_RESOLUTION_MS));
+    advance(lfuMinutes, static_cast<uint32_t>(ms / 60000) & LFU_MINUTES_MASK);
+  }
+
+  // records an access to a key, created tells a new key from an existing
+  // one. may run under a shared lock, concurrent updates can get lost,
+  // which only makes the approximation a little coarser.
+  void touch(std::atomic<uint32_t>& clock, bool created) const {
+    if (lru()) {
+      uint32_t now = lruClock.load(std::memory_order_relaxed);
+      // skip the store when nothing changed to keep the line clean.
+      if (created || clock.load(std::memory_order_relaxed) != now) {
+        clock.store(now, std::memory_order_relaxed);
+      }
+    } else if (lfu()) {
+      uint32_t counter =
+          created ? LFU_INIT
+                  : increment(decayed(clock.load(std::memory_order_relaxed)));
+      clock.store(lfuMinutes.load(std::memory_order_relaxed) << 8 | counter,
+                  std::memory_order_relaxed);
+    }
+  }
+
+  // evicts keys until the dataset fits maxmemory again. runs before the
+  // command takes its own key locks, and returns false when the memory
+  // cannot be freed, in which case the write must be refused.
+  auto make_room() -> bool {
+    if (maxmemory == 0 || Memory::used() <= maxmemory) {
+      return true;
+    }
+    if (policy == Policy::NOEVICTION) {
+      return false;
+    }
+    // gives up once a round of attempts in a row found nothing to evict.
+    int misses = 0;
+    while (Memory::used() > maxmemory) {
+      if (evict_one()) {
+        misses = 0;
+      } else if (++misses >= static_cast<int>(Database::SHARDS)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  auto evicted() const -> uint64_t {
+    return evictions.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // wraps after about 500 days, keys idle longer than that look fresh.
+  static constexpr uint32_t LRU_RESOLUTION_MS = 10;
+  static constexpr uint32_t LFU_MINUTES_MASK = 0xffffff;
+  // new keys start with some credit so they are not evicted right away.
+  static constexpr uint32_t LFU_INIT = 5;
+  static constexpr uint32_t LFU_LOG_FACTOR = 10;
+  static constexpr uint32_t LFU_DECAY_MINUTES = 1;
+
+  Eviction() : maxmemory(0), policy(Policy::NOEVICTION), samples(5) {
+    tick(std::chrono::steady_clock::now());
+  }
+
+  // stores only on change, so the reactors do not keep stealing the line.
+  static void advance(std::atomic<uint32_t>& clock, uint32_t value) {
+    if (clock.load(std::memory_order_relaxed) != value) {
+      clock.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  // the access counter once the minutes without access are taken off.
+  auto decayed(uint32_t clock) const -> uint32_t {
+    uint32_t counter = clock & 0xff;
+    uint32_t elapsed =
+        (lfuMinutes.load(std::memory_order_relaxed) - (clock >> 8)) &
+        LFU_MINUTES_MASK;
+    uint32_t periods = elapsed / LFU_DECAY_MINUTES;
+    return periods >= counter ? 0 : counter - periods;
+  }
+
+  // bumps the counter with a probability that falls as it grows, so 8 bits
+  // cover millions of accesses.
+  static auto increment(uint32_t counter) -> uint32_t {
+    if (counter == 255) {
+      return counter;
+    }
+    uint32_t base = counter > LFU_INIT ? counter - LFU_INIT : 0;
+    double p = 1.0 / (base * LFU_LOG_FACTOR + 1);
+    double r = static_cast<double>(random64() >> 11) / (uint64_t(1) << 53);
+    return r < p ? counter + 1 : counter;
+  }
+
+  auto lru() const -> bool {
+    return policy == Policy::ALLKEYS_LRU || policy == Policy::VOLATILE_LRU;
+  }
+
+  auto lfu() const -> bool {
+    return policy == Policy::ALLKEYS_LFU || policy == Policy::VOLATILE_LFU;
+  }
+
+  auto volatile_only() const -> bool {
+    return policy == Policy::VOLATILE_LRU || policy == Policy::VOLATILE_LFU ||
+           policy == Policy::VOLATILE_RANDOM || policy == Policy::VOLATILE_TTL;
+  }
+
+  // how good a victim a key is, higher goes first.
+  auto score(uint32_t clock, int64_t deadline) const -> uint64_t {
+    if (lru()) {
+      return lruClock.load(std::memory_order_relaxed) - clock;
+    }
+    if (lfu()) {
+      return 255 - decayed(clock);
+    }
+    if (policy == Policy::VOLATILE_TTL) {
+      return INT64_MAX - deadline;
+    }
+    return 0;
+  }
+
+  // evicts the best of a few keys sampled from a random shard, returns false
+  // when that shard has nothing to evict.
+  auto evict_one() -> bool {
+    auto& shard = Database::shards()[random64() % Database::SHARDS];
+    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+
+    std::string victim;
+    uint64_t best = 0;
+    bool found = false;
+    auto consider = [&](std::string_view key, uint64_t s) {
+      if (!found || s > best) {
+        victim.assign(key);
+        best = s;
+        found = true;
+      }
+    };
+    if (volatile_only()) {
+      // the clock is kept in the entry of the key itself.
+      const auto& sets = shard.sets;
+      const auto& hsets = shard.hsets;
+      shard.expires.sample(random64(), samples, [&](const auto& entry) {
+        uint32_t clock = 0;
+        if (auto e = sets.find_entry(entry.key())) {
+          clock = e->clock.load(std::memory_order_relaxed);
+        } else if (auto e = hsets.find_entry(entry.key())) {
+          clock = e->clock.load(std::memory_order_relaxed);
+        }
+        consider(entry.key(), score(clock, entry.value));
+      });
+    } else {
+      auto sampled = [&](const auto& entry) {
+        consider(entry.key(),
+                 score(entry.clock.load(std::memory_order_relaxed), 0));
+      };
+      shard.sets.sample(random64(), samples, sampled);
+      shard.hsets.sample(random64(), samples, sampled);
+    }
+    if (!found) {
+      return false;
+    }
+
+    Database::erase(shard, victim);
+    // the aof must forget the key too, or a restart would bring it back.
+    if (Aof::instance().enabled()) {
+      std::string frame;
+      Aof::append_command(frame, {"DEL", victim});
+      Aof::instance().save(frame);
+    }
+    evictions.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  size_t maxmemory;
+  Policy policy;
+  size_t samples;
+
+  std::atomic<uint32_t> lruClock;
+  std::atomic<uint32_t> lfuMinutes;
+  std::atomic<uint64_t> evictions{0};
+};
+};  // namespace resp
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+
+#include "youdis/aof.hpp"
+#include "youdis/arena.hpp"
+#include "youdis/database.hpp"
+#include "youdis/random.hpp"
+
+namespace resp {
+// key ttls. a key past its deadline is gone for readers right away, and is
+// removed either by the next write that touches it or by the active cycle,
+// which samples keys with a ttl in the background under a time budget.
+// removals reach the aof as DEL, so replay never depends on the clock.
+class Expiration {
+ public:
+  static auto instance() -> Expiration& {
+    static Expiration expiration;
+    return expiration;
+  }
+
+  // the deadline of key, or -1 when it has none.
+  static auto deadline(const Database::Shard& shard, std::string_view key)
+      -> int64_t {
+    if (shard.expires.empty()) {
+      return -1;
+    }
+    auto at = shard.expires.find(key);
+    return at ? *at : -1;
+  }
+
+  // whether the entry of a key is past its deadline. only reads, so it is
+  // safe under a shared lock.
+  template <class Entry>
+  static auto expired(const Database::Shard& shard, const Entry& entry)
+      -> bool {
+    if (!entry.flag) {
+      return false;
+    }
+    auto at = shard.expires.find(entry.key());
+    return at && *at <= Database::now();
+  }
+
+  // gives an existing key a deadline, the shard must be locked exclusively.
+  static void set(Database::Shard& shard, std::string_view key, int64_t at) {
+    *shard.expires.insert(key).first = at;
+    mark(shard, key, true);
+  }
+
+  // drops the deadline of key, returns whether it had one.
+  static auto persist(Database::Shard& shard, std::string_view key) -> bool {
+    if (shard.expires.empty() || !shard.expires.erase(key)) {
+      return false;
+    }
+    mark(shard, key, false);
+    return true;
+  }
+
+  // flags an entry just created for a key that already has a deadline, which
+  // happens when the key exists with the other type.
+  template <class Entry>
+  static void adopt(Database::Shard& shard, Entry& entry) {
+    if (!shard.expires.empty() && shard.expires.find(entry.key())) {
+      entry.flag = 1;
+    }
+  }
+
+  // removes key when it is past its deadline, the shard must be locked
+  // exclusively. writes call it before touching a key.
+  auto expire_if_needed(Database::Shard& shard, std::string_view key)
+      -> bool {
+    if (shard.expires.empty()) {
+      return false;
+    }
+    auto at = shard.expires.find(key);
+    if (at == nullptr || *at > Database::now()) {
+      return false;
+    }
+    remove(shard, key);
+    return true;
+  }
+
+  // removes key and tells the aof, the shard must be locked exclusively.
+  void remove(Database::Shard& shard, std::string_view key) {
+    Database::erase(shard, key);
+    if (Aof::instance().enabled()) {
+      std::string frame;
+      Aof::append_command(frame, {"DEL", key});
+      Aof::instance().save(frame);
+    }
+    removed.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // one round of active expiry over the shards first, first + stride, ...
+  // each shard is sampled until less than a quarter of the sampled keys had
+  // expired. returns true when it stopped on the budget or skipped a busy
+  // shard, so the caller should come back soon.
+  auto cycle(size_t first, size_t stride, std::chrono::microseconds budget)
+      -> bool {
+    auto deadline = std::chrono::steady_clock::now() + budget;
+    Arena& arena = Arena::local();
+    bool behind = false;
+    for (size_t i = first; i < Database::SHARDS; i += stride) {
+      auto& shard = Database::shards()[i];
+      std::unique_lock<std::shared_mutex> lock(shard.mtx, std::try_to_lock);
+      if (!lock.owns_lock()) {
+        behind = true;
+        continue;
+      }
+      while (!shard.expires.empty()) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+          return true;
+        }
+        // keys are copied out before removing, the sampled entries die with
+        // them.
+        auto victims = arena.make_array<std::string_view>(SAMPLES);
+        size_t sampled = 0;
+        size_t n = 0;
+        int64_t ms = Database::now();
+        shard.expires.sample(random64(), SAMPLES, [&](const auto& entry) {
+          ++sampled;
+          if (entry.value <= ms) {
+            auto key = entry.key();
+            auto copy = static_cast<char*>(arena.allocate(key.size(), 1));
+            std::memcpy(copy, key.data(), key.size());
+            victims[n++] = std::string_view(copy, key.size());
+          }
+        });
+        for (size_t j = 0; j < n; ++j) {
+          remove(shard, victims[j]);
+        }
+        if (n * 4 < sampled || sampled == 0) {
+          break;
+        }
+      }
+    }
+    return behind;
+  }
+
+  auto expired() const -> uint64_t {
+    return removed.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static constexpr size_t SAMPLES = 20;
+
+  Expiration() = default;
+
+  static void mark(Database::Shard& shard, std::string_view key, bool on) {
+    if (auto e = shard.sets.find_entry(key)) {
+      e->flag = on;
+    }
+    if (auto e = shard.hsets.find_entry(key)) {
+      e->flag = on;
+    }
+  }
+
+  std::atomic<uint64_t> removed{0};
+};
+};  // namespace resp
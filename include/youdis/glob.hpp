@@ -0,0 +1,98 @@
+#pragma once
+
+#include <string_view>
+#include <utility>
+
+namespace resp {
+// redis style glob patterns: * matches any run of bytes, ? any one byte,
+// [abc], [a-z] and [^abc] a byte of a set, and \ takes the next byte
+// literally.
+class Glob {
+ public:
+  static auto match(std::string_view pattern, std::string_view s) -> bool {
+    size_t p = 0;
+    size_t i = 0;
+    // where to resume after the last *: the pattern past it, and the first
+    // byte of s it has not swallowed yet.
+    size_t starP = std::string_view::npos;
+    size_t starI = 0;
+    while (i < s.size()) {
+      if (p < pattern.size()) {
+        if (pattern[p] == '*') {
+          starP = ++p;
+          starI = i;
+          continue;
+        }
+        size_t next;
+        if (one(pattern, p, s[i], next)) {
+          p = next;
+          ++i;
+          continue;
+        }
+      }
+      if (starP == std::string_view::npos) {
+        return false;
+      }
+      // let the * swallow one more byte and retry.
+      p = starP;
+      i = ++starI;
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+      ++p;
+    }
+    return p == pattern.size();
+  }
+
+ private:
+  // whether the pattern element at p matches c, next is set past it.
+  static auto one(std::string_view pattern, size_t p, char c, size_t& next)
+      -> bool {
+    switch (pattern[p]) {
+      case '?':
+        next = p + 1;
+        return true;
+      case '[':
+        return set(pattern, p + 1, c, next);
+      case '\\':
+        if (p + 1 < pattern.size()) {
+          ++p;
+        }
+        [[fallthrough]];
+      default:
+        next = p + 1;
+        return pattern[p] == c;
+    }
+  }
+
+  // a [...] set starting at p, an unterminated one runs to the end.
+  static auto set(std::string_view pattern, size_t p, char c, size_t& next)
+      -> bool {
+    bool negate = p < pattern.size() && pattern[p] == '^';
+    if (negate) {
+      ++p;
+    }
+    bool found = false;
+    while (p < pattern.size() && pattern[p] != ']') {
+      if (pattern[p] == '\\' && p + 1 < pattern.size()) {
+        found = found || pattern[p + 1] == c;
+        p += 2;
+      } else if (p + 2 < pattern.size() && pattern[p + 1] == '-' &&
+                 pattern[p + 2] != ']') {
+        auto lo = static_cast<unsigned char>(pattern[p]);
+        auto hi = static_cast<unsigned char>(pattern[p + 2]);
+        if (lo > hi) {
+          std::swap(lo, hi);
+        }
+        auto u = static_cast<unsigned char>(c);
+        found = found || (u >= lo && u <= hi);
+        p += 3;
+      } else {
+        found = found || pattern[p] == c;
+        ++p;
+      }
+    }
+    next = p < pattern.size() ? p + 1 : p;
+    return found != negate;
+  }
+};
+};  // namespace resp
@@ -1,173 +1,1123 @@
 #pragma once
 
+#include <unistd.h>
+
 #include <algorithm>
-#include <atomic>
-#include <functional>
-#include <iterator>
-#include <mutex>
-#include <unordered_map>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
 #include <vector>
 
 #include "resp.hpp"
 #include "utils.hpp"
 #include "youdis/aof.hpp"
 #include "youdis/database.hpp"
+#include "youdis/eviction.hpp"
+#include "youdis/expiration.hpp"
+#include "youdis/glob.hpp"
+#include "youdis/snapshot.hpp"
+#include "youdis/stats.hpp"
 
 namespace resp {
+// the arguments of a command, without the command name.
+class Args {
+ public:
+  Args(const Slice* data_, size_t size_) : data(data_), n(size_) {}
+
+  auto size() const -> size_t { return n; }
+  auto empty() const -> bool { return n == 0; }
+  auto operator[](size_t i) const -> const Slice& { return data[i]; }
+  auto begin() const -> const Slice* { return data; }
+  auto end() const -> const Slice* { return data + n; }
+
+ private:
+  const Slice* data;
+  size_t n;
+};
+
 class Command {
  public:
-  static auto cmds()
-      -> std::unordered_map<std::string,
-                            std::function<std::unique_ptr<Value>(
-                                const std::vector<std::unique_ptr<Value>>&)>>& {
-    static std::unordered_map<std::string,
-                              std::function<std::unique_ptr<Value>(
-                                  const std::vector<std::unique_ptr<Value>>&)>>
-        commands;
-    static std::atomic<bool> inited(false);
-    if (!inited) {
-      inited = true;
-      commands["PING"] = ping;
-      commands["SET"] = set;
-      commands["GET"] = get;
-      commands["HSET"] = hset;
-      commands["HGET"] = hget;
-      commands["HGETALL"] = hget_all;
-    }
-    return commands;
+  using Function = bool (*)(const Args&, Buffer&);
+
+  enum Flags : uint32_t {
+    // changes the dataset: keys are locked exclusively and the command is
+    // persisted.
+    WRITE = 1 << 0,
+    // only reads the dataset, keys are locked shared.
+    READONLY = 1 << 1,
+    // server administration rather than data access.
+    ADMIN = 1 << 2,
+    // can grow the dataset: runs eviction first and is refused when no
+    // memory could be freed.
+    DENYOOM = 1 << 3,
+  };
+
+  struct Spec {
+    // upper case, matched case-insensitively.
+    Slice name;
+    Function handler;
+    // the number of arguments including the name, -n means at least n.
+    int arity;
+    uint32_t flags;
+    // positions of the keys in argv, where argv[0] is the command name. a
+    // negative lastKey counts from the end, firstKey 0 means no keys.
+    int firstKey;
+    int lastKey;
+    int step;
+  };
+
+  // the command table, built at compile time.
+  static constexpr auto table() {
+    return std::array{
+        Spec{"PING", ping, -1, READONLY, 0, 0, 0},
+        Spec{"SET", set, -3, WRITE | DENYOOM, 1, 1, 1},
+        Spec{"GET", get, 2, READONLY, 1, 1, 1},
+        Spec{"MSET", mset, -3, WRITE | DENYOOM, 1, -1, 2},
+        Spec{"MGET", mget, -2, READONLY, 1, -1, 1},
+        Spec{"DEL", del, -2, WRITE, 1, -1, 1},
+        Spec{"EXPIRE", expire, 3, WRITE, 1, 1, 1},
+        Spec{"PEXPIRE", pexpire, 3, WRITE, 1, 1, 1},
+        Spec{"EXPIREAT", expireat, 3, WRITE, 1, 1, 1},
+        Spec{"PEXPIREAT", pexpireat, 3, WRITE, 1, 1, 1},
+        Spec{"PERSIST", persist, 2, WRITE, 1, 1, 1},
+        Spec{"TTL", ttl, 2, READONLY, 1, 1, 1},
+        Spec{"PTTL", pttl, 2, READONLY, 1, 1, 1},
+        Spec{"HSET", hset, -4, WRITE | DENYOOM, 1, 1, 1},
+        Spec{"HMSET", hmset, -4, WRITE | DENYOOM, 1, 1, 1},
+        Spec{"HGET", hget, 3, READONLY, 1, 1, 1},
+        Spec{"HMGET", hmget, -3, READONLY, 1, 1, 1},
+        Spec{"HDEL", hdel, -3, WRITE, 1, 1, 1},
+        Spec{"HGETALL", hget_all, 2, READONLY, 1, 1, 1},
+        Spec{"SCAN", scan, -2, READONLY, 0, 0, 0},
+        Spec{"HSCAN", hscan, -3, READONLY, 1, 1, 1},
+        Spec{"BGREWRITEAOF", bgrewriteaof, 1, ADMIN, 0, 0, 0},
+        Spec{"SAVE", save, 1, ADMIN, 0, 0, 0},
+        Spec{"BGSAVE", bgsave, 1, ADMIN, 0, 0, 0},
+        Spec{"INFO", info, -1, READONLY, 0, 0, 0},
+    };
   }
 
  private:
-  static auto ping(const std::vector<std::unique_ptr<Value>>& args)
-      -> std::unique_ptr<Value> {
+  static constexpr size_t SLOTS = 64;
+  static constexpr uint8_t EMPTY = 0xff;
+
+  static constexpr auto upper(char c) -> char {
+    return c >= 'a' && c <= 'z' ? static_cast<char>(c - 'a' + 'A') : c;
+  }
+
+  static constexpr auto slot(Slice name, uint32_t seed) -> size_t {
+    uint32_t h = seed;
+    for (char c : name) {
+      h = (h ^ static_cast<uint8_t>(upper(c))) * 0x01000193u;
+    }
+    return (h ^ (h >> 16)) & (SLOTS - 1);
+  }
+
+  static constexpr auto equals(Slice name, Slice upperName) -> bool {
+    if (name.size() != upperName.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < name.size(); ++i) {
+      if (upper(name[i]) != upperName[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // the first seed under which every command gets a slot of its own.
+  template <class Specs>
+  static constexpr auto perfect_seed(const Specs& specs) -> uint32_t {
+    for (uint32_t seed = 1; seed < 100000; ++seed) {
+      bool used[SLOTS] = {};
+      bool perfect = true;
+      for (auto& spec : specs) {
+        size_t i = slot(spec.name, seed);
+        perfect = perfect && !used[i];
+        used[i] = true;
+      }
+      if (perfect) {
+        return seed;
+      }
+    }
+    return 0;
+  }
+
+  static auto specs() -> const auto& {
+    static constexpr auto s = table();
+    static_assert(s.size() <= Stats::COMMANDS, "Stats::COMMANDS too small");
+    return s;
+  }
+
+  template <class Specs>
+  static constexpr auto build_index(const Specs& specs, uint32_t seed)
+      -> std::array<uint8_t, SLOTS> {
+    std::array<uint8_t, SLOTS> index{};
+    for (auto& i : index) {
+      i = EMPTY;
+    }
+    for (size_t i = 0; i < specs.size(); ++i) {
+      index[slot(specs[i].name, seed)] = static_cast<uint8_t>(i);
+    }
+    return index;
+  }
+
+ public:
+  // finds a command by name without allocating: the table is indexed by a
+  // perfect hash of the upper cased name, picked at compile time.
+  static auto lookup(Slice name) -> const Spec* {
+    static constexpr uint32_t seed = perfect_seed(table());
+    static_assert(seed != 0, "no perfect hash for the command table");
+    static constexpr auto index = build_index(table(), seed);
+
+    uint8_t i = index[slot(name, seed)];
+    if (i == EMPTY || !equals(name, specs()[i].name)) {
+      return nullptr;
+    }
+    return &specs()[i];
+  }
+
+  // the position of a command in the table, which the per command stats
+  // are kept by.
+  static auto position(const Spec& spec) -> size_t {
+    return &spec - specs().data();
+  }
+
+  static auto arity_ok(const Spec& spec, size_t argc) -> bool {
+    int n = static_cast<int>(argc);
+    return spec.arity >= 0 ? n == spec.arity : n >= -spec.arity;
+  }
+
+  // the shards holding the keys of a request.
+  static auto shards(const Spec& spec, const Request& request) -> uint64_t {
+    uint64_t mask = 0;
+    if (spec.firstKey == 0) {
+      return mask;
+    }
+    int argc = static_cast<int>(request.argc);
+    int last = spec.lastKey < 0 ? argc + spec.lastKey : spec.lastKey;
+    for (int i = spec.firstKey; i <= last && i < argc; i += spec.step) {
+      mask |= Database::mask(request.argv[i]);
+    }
+    return mask;
+  }
+
+  // a handler can persist another form of its command than the frame the
+  // client sent, e.g. with a relative ttl made absolute, by writing it here.
+  static auto rewritten() -> std::string& {
+    thread_local std::string frame;
+    return frame;
+  }
+
+ private:
+  // the handlers below run with the shards of their keys already locked.
+  // they serialize their reply into out and return false when they rejected
+  // the command with an error. keys are looked up and created through
+  // find_key() and upsert_key(), which hide expired keys and keep the
+  // eviction clock current.
+
+  template <class V>
+  static auto find_key(const Database::Shard& shard, const Dict<V>& dict,
+                       Slice key) -> const V* {
+    return find_key(shard, dict, key, hash(key));
+  }
+
+  // the same with h = hash(key) already computed, for batches.
+  template <class V>
+  static auto find_key(const Database::Shard& shard, const Dict<V>& dict,
+                       Slice key, uint64_t h) -> const V* {
+    auto e = dict.find_entry(key, h);
+    if (e == nullptr || Expiration::expired(shard, *e)) {
+      return nullptr;
+    }
+    Eviction::instance().touch(e->clock, false);
+    return &e->value;
+  }
+
+  // writes hold the shard exclusively, so an expired key is removed here
+  // before it would be reused.
+  template <class V>
+  static auto upsert_key(Database::Shard& shard, Dict<V>& dict, Slice key)
+      -> V* {
+    return upsert_key(shard, dict, key, hash(key));
+  }
+
+  template <class V>
+  static auto upsert_key(Database::Shard& shard, Dict<V>& dict, Slice key,
+                         uint64_t h) -> V* {
+    Expiration::instance().expire_if_needed(shard, key);
+    auto [e, inserted] = dict.insert_entry(key, h);
+    if (inserted) {
+      Expiration::adopt(shard, *e);
+    }
+    Eviction::instance().touch(e->clock, inserted);
+    return &e->value;
+  }
+
+  // how many keys ahead of the one being probed a batch prefetches the
+  // first entry of the bucket.
+  static constexpr size_t PREFETCH = 8;
+
+  // a SCAN cursor keeps the position of the dict it is in, two per shard,
+  // in its low bits.
+  static constexpr size_t SCAN_POSITION_BITS = Database::SHARD_BITS + 1;
+  static constexpr size_t SCAN_POSITIONS = size_t(1) << SCAN_POSITION_BITS;
+  // the buckets a scan may step through per key it was asked for, and the
+  // largest COUNT taken, above which the step budget would overflow.
+  static constexpr size_t SCAN_STEPS = 10;
+  static constexpr size_t SCAN_COUNT_MAX =
+      std::numeric_limits<size_t>::max() / SCAN_STEPS;
+
+  // room for batches of n, kept per thread between commands.
+  template <class T>
+  static auto scratch(size_t n) -> T* {
+    thread_local std::vector<T> v;
+    if (v.size() < n) {
+      v.resize(n);
+    }
+    return v.data();
+  }
+
+  // calls f(i, h) for i from 0 to n - 1 in order, h being the hash of
+  // key(i) in dict(h). all keys are hashed and their bucket slots
+  // prefetched first, then the first entries of the buckets PREFETCH keys
+  // ahead are prefetched while probing, so the cache misses of a batch
+  // overlap instead of adding up. f should only probe, replies are best
+  // serialized in a pass of their own afterwards.
+  template <class Key, class DictOf, class F>
+  static void pipelined(size_t n, Key&& key, DictOf&& dict, F&& f) {
+    auto hashes = scratch<uint64_t>(n);
+    for (size_t i = 0; i < n; ++i) {
+      hashes[i] = hash(key(i));
+      dict(hashes[i]).prefetch(hashes[i], false);
+    }
+    for (size_t i = 0; i < n; ++i) {
+      if (i + PREFETCH < n) {
+        uint64_t ahead = hashes[i + PREFETCH];
+        dict(ahead).prefetch(ahead, true);
+      }
+      f(i, hashes[i]);
+    }
+  }
+
+  // replies with the values of a batch, an empty bulk for each missing one.
+  static void values_reply(const Object* const* values, size_t n,
+                           Buffer& out) {
+    Serializer::array(out, n);
+    for (size_t i = 0; i < n; ++i) {
+      if (values[i] == nullptr) {
+        out.append(Serializer::EMPTY_BULK);
+      } else {
+        Object::Digits digits;
+        Serializer::bulk(out, values[i]->view(digits));
+      }
+    }
+  }
+
+  // commands taking field value pairs from args[first] on.
+  static auto pairs_ok(const Args& args, size_t first, Slice command,
+                       Buffer& out) -> bool {
+    if ((args.size() - first) % 2 == 0) {
+      return true;
+    }
+    out.append("-ERR wrong number of arguments for '");
+    out.append(command);
+    out.append("' command\r\n");
+    return false;
+  }
+
+  static auto exists(const Database::Shard& shard, Slice key) -> bool {
+    return find_key(shard, shard.sets, key) ||
+           find_key(shard, shard.hsets, key);
+  }
+
+  static auto integer_arg(Slice arg, int64_t& n, Buffer& out) -> bool {
+    if (!Object::parse_int(arg, n)) {
+      Serializer::err(out, "ERR value is not an integer or out of range");
+      return false;
+    }
+    return true;
+  }
+
+  // turns an expire argument into a deadline in unix milliseconds. unit is
+  // 1000 for seconds and 1 for milliseconds, relative adds the current time.
+  static auto deadline_arg(Slice arg, int64_t unit, bool relative,
+                           Slice command, int64_t& at, Buffer& out) -> bool {
+    int64_t n;
+    if (!integer_arg(arg, n, out)) {
+      return false;
+    }
+    int64_t base = relative ? Database::now() : 0;
+    if (n > (INT64_MAX - base) / unit || n < (INT64_MIN + base) / unit) {
+      out.append("-ERR invalid expire time in '");
+      out.append(command);
+      out.append("' command\r\n");
+      return false;
+    }
+    at = n * unit + base;
+    return true;
+  }
+
+  static auto ping(const Args& args, Buffer& out) -> bool {
     if (args.empty()) {
-      return Value::make_str("PONG");
+      out.append(Serializer::PONG);
+    } else {
+      Serializer::str(out, args[0]);
+    }
+    return true;
+  }
+
+  // SET key value [EX seconds | PX ms | EXAT seconds | PXAT ms | KEEPTTL]
+  static auto set(const Args& args, Buffer& out) -> bool {
+    auto key = args[0];
+    // the expire option, if any: its argument, unit and whether relative.
+    const Slice* expire = nullptr;
+    int64_t unit = 1;
+    bool relative = false;
+    bool keep = false;
+    for (size_t i = 2; i < args.size(); ++i) {
+      auto option = args[i];
+      bool ttl = expire == nullptr && !keep;
+      if (equals(option, "KEEPTTL") && ttl) {
+        keep = true;
+      } else if (ttl && i + 1 < args.size() &&
+                 (equals(option, "EX") || equals(option, "PX") ||
+                  equals(option, "EXAT") || equals(option, "PXAT"))) {
+        expire = &args[++i];
+        unit = upper(option[0]) == 'E' ? 1000 : 1;
+        relative = option.size() == 2;
+      } else {
+        Serializer::err(out, "ERR syntax error");
+        return false;
+      }
+    }
+    int64_t at = -1;
+    if (expire != nullptr) {
+      int64_t n;
+      if (!integer_arg(*expire, n, out)) {
+        return false;
+      }
+      if (n <= 0) {
+        Serializer::err(out, "ERR invalid expire time in 'set' command");
+        return false;
+      }
+      if (!deadline_arg(*expire, unit, relative, "set", at, out)) {
+        return false;
+      }
+    }
+
+    auto& shard = Database::shard(key);
+    upsert_key(shard, shard.sets, key)->assign(args[1]);
+    if (at != -1) {
+      Expiration::set(shard, key, at);
+      Object::Digits digits;
+      Aof::append_command(rewritten(), {"SET", key, args[1], "PXAT",
+                                        Object::format(at, digits)});
+    } else if (!keep) {
+      Expiration::persist(shard, key);
+    }
+    out.append(Serializer::OK);
+    return true;
+  }
+
+  static auto get(const Args& args, Buffer& out) -> bool {
+    auto key = args[0];
+    auto& shard = Database::shard(key);
+    auto value = find_key(shard, shard.sets, key);
+    if (value == nullptr) {
+      out.append(Serializer::EMPTY_BULK);
+    } else {
+      Object::Digits digits;
+      Serializer::bulk(out, value->view(digits));
+    }
+    return true;
+  }
+
+  // MSET key value [key value ...], like a SET of each pair.
+  static auto mset(const Args& args, Buffer& out) -> bool {
+    if (!pairs_ok(args, 0, "mset", out)) {
+      return false;
+    }
+    pipelined(
+        args.size() / 2, [&args](size_t i) { return args[2 * i]; },
+        [](uint64_t h) -> auto& { return Database::shard_of(h).sets; },
+        [&args](size_t i, uint64_t h) {
+          auto key = args[2 * i];
+          auto& shard = Database::shard_of(h);
+          upsert_key(shard, shard.sets, key, h)->assign(args[2 * i + 1]);
+          Expiration::persist(shard, key);
+        });
+    out.append(Serializer::OK);
+    return true;
+  }
+
+  static auto mget(const Args& args, Buffer& out) -> bool {
+    auto values = scratch<const Object*>(args.size());
+    pipelined(
+        args.size(), [&args](size_t i) { return args[i]; },
+        [](uint64_t h) -> auto& { return Database::shard_of(h).sets; },
+        [&args, values](size_t i, uint64_t h) {
+          const auto& shard = Database::shard_of(h);
+          values[i] = find_key(shard, shard.sets, args[i], h);
+        });
+    values_reply(values, args.size(), out);
+    return true;
+  }
+
+  static auto del(const Args& args, Buffer& out) -> bool {
+    long long n = 0;
+    for (auto key : args) {
+      auto& shard = Database::shard(key);
+      if (!Expiration::instance().expire_if_needed(shard, key)) {
+        n += Database::erase(shard, key);
+      }
     }
-    return Value::make_str(
-        std::string(args[0]->bulk.begin(), args[0]->bulk.end()));
+    Serializer::integer(out, n);
+    return true;
+  }
+
+  static auto expire(const Args& args, Buffer& out) -> bool {
+    return expire_generic(args, 1000, true, "expire", out);
+  }
+
+  static auto pexpire(const Args& args, Buffer& out) -> bool {
+    return expire_generic(args, 1, true, "pexpire", out);
+  }
+
+  static auto expireat(const Args& args, Buffer& out) -> bool {
+    return expire_generic(args, 1000, false, "expireat", out);
+  }
+
+  static auto pexpireat(const Args& args, Buffer& out) -> bool {
+    return expire_generic(args, 1, false, "pexpireat", out);
   }
 
-  static auto set(const std::vector<std::unique_ptr<Value>>& args)
-      -> std::unique_ptr<Value> {
-    if (args.size() < 2) {
-      return Value::make_err("ERR wrong number of arguments for 'set' command");
+  // replies 1 when the key got the deadline, 0 when it does not exist. a
+  // deadline in the past deletes the key. persisted as PEXPIREAT or DEL.
+  static auto expire_generic(const Args& args, int64_t unit, bool relative,
+                             Slice command, Buffer& out) -> bool {
+    auto key = args[0];
+    int64_t at;
+    if (!deadline_arg(args[1], unit, relative, command, at, out)) {
+      return false;
+    }
+    auto& shard = Database::shard(key);
+    Expiration::instance().expire_if_needed(shard, key);
+    if (!exists(shard, key)) {
+      out.append(Serializer::ZERO);
+      return true;
     }
-    std::string key(args[0]->bulk.begin(), args[0]->bulk.end());
-    std::string value(args[1]->bulk.begin(), args[1]->bulk.end());
+    if (at <= Database::now()) {
+      Database::erase(shard, key);
+      Aof::append_command(rewritten(), {"DEL", key});
+    } else {
+      Expiration::set(shard, key, at);
+      Object::Digits digits;
+      Aof::append_command(rewritten(),
+                          {"PEXPIREAT", key, Object::format(at, digits)});
+    }
+    out.append(Serializer::ONE);
+    return true;
+  }
 
-    auto set_ = Database::sets();
-    {
-      std::lock_guard<std::mutex> guard(set_.second);
-      set_.first[key] = value;
+  static auto persist(const Args& args, Buffer& out) -> bool {
+    auto key = args[0];
+    auto& shard = Database::shard(key);
+    Expiration::instance().expire_if_needed(shard, key);
+    out.append(Expiration::persist(shard, key) ? Serializer::ONE
+                                               : Serializer::ZERO);
+    return true;
+  }
+
+  static auto ttl(const Args& args, Buffer& out) -> bool {
+    ttl_generic(args[0], 1000, out);
+    return true;
+  }
+
+  static auto pttl(const Args& args, Buffer& out) -> bool {
+    ttl_generic(args[0], 1, out);
+    return true;
+  }
+
+  // -2 when the key does not exist, -1 when it has no deadline.
+  static void ttl_generic(Slice key, int64_t unit, Buffer& out) {
+    auto& shard = Database::shard(key);
+    if (!exists(shard, key)) {
+      Serializer::integer(out, -2);
+      return;
+    }
+    int64_t at = Expiration::deadline(shard, key);
+    if (at == -1) {
+      Serializer::integer(out, -1);
+      return;
     }
-    return Value::make_str("OK");
+    int64_t left = std::max<int64_t>(at - Database::now(), 0);
+    Serializer::integer(out, (left + unit / 2) / unit);
   }
 
-  static auto get(const std::vector<std::unique_ptr<Value>>& args)
-      -> std::unique_ptr<Value> {
-    if (args.size() != 1) {
-      return Value::make_err("ERR wrong number of arguments for 'get' command");
+  static auto hset(const Args& args, Buffer& out) -> bool {
+    return hset_generic(args, "hset", out);
+  }
+
+  static auto hmset(const Args& args, Buffer& out) -> bool {
+    return hset_generic(args, "hmset", out);
+  }
+
+  // key field value [field value ...]
+  static auto hset_generic(const Args& args, Slice command, Buffer& out)
+      -> bool {
+    if (!pairs_ok(args, 1, command, out)) {
+      return false;
+    }
+    auto m = args[0];
+    auto& shard = Database::shard(m);
+    auto& hash = *upsert_key(shard, shard.hsets, m);
+    size_t longest = 0;
+    for (size_t i = 1; i < args.size(); ++i) {
+      longest = std::max(longest, args[i].size());
+    }
+    hash.reserve(
+        args.size() / 2, [&args](size_t i) { return args[2 * i + 1]; },
+        longest);
+    if (auto table = hash.table()) {
+      pipelined(
+          args.size() / 2, [&args](size_t i) { return args[2 * i + 1]; },
+          [table](uint64_t) -> auto& { return *table; },
+          [&args, table](size_t i, uint64_t h) {
+            table->insert_entry(args[2 * i + 1], h)
+                .first->value.assign(args[2 * i + 2]);
+          });
+    } else {
+      for (size_t i = 1; i < args.size(); i += 2) {
+        hash.set(args[i], args[i + 1]);
+      }
     }
-    std::string key(args[0]->bulk.begin(), args[0]->bulk.end());
-    std::string value;
+    out.append(Serializer::OK);
+    return true;
+  }
+
+  // replies with the value of field in hash, which may be nullptr.
+  static void field_reply(const Hash* hash, Slice field, Buffer& out) {
+    Slice value;
+    Object::Digits digits;
+    if (hash != nullptr && hash->find(field, value, digits)) {
+      Serializer::bulk(out, value);
+    } else {
+      out.append(Serializer::EMPTY_BULK);
+    }
+  }
 
-    auto set_ = Database::sets();
-    {
-      std::lock_guard<std::mutex> guard(set_.second);
-      if (set_.first.find(key) != set_.first.end()) {
-        value = set_.first[key];
+  static auto hget(const Args& args, Buffer& out) -> bool {
+    auto m = args[0];
+    auto& shard = Database::shard(m);
+    field_reply(find_key(shard, shard.hsets, m), args[1], out);
+    return true;
+  }
+
+  static auto hmget(const Args& args, Buffer& out) -> bool {
+    auto m = args[0];
+    size_t n = args.size() - 1;
+    auto& shard = Database::shard(m);
+    auto hash = find_key(shard, shard.hsets, m);
+    auto table = hash != nullptr ? hash->table() : nullptr;
+    if (table == nullptr) {
+      // a listpack is a single block, scanning it has nothing to prefetch.
+      Serializer::array(out, n);
+      for (size_t i = 1; i <= n; ++i) {
+        field_reply(hash, args[i], out);
       }
+      return true;
+    }
+    auto values = scratch<const Object*>(n);
+    pipelined(
+        n, [&args](size_t i) { return args[i + 1]; },
+        [table](uint64_t) -> auto& { return *table; },
+        [&args, table, values](size_t i, uint64_t h) {
+          values[i] = table->find(args[i + 1], h);
+        });
+    values_reply(values, n, out);
+    return true;
+  }
+
+  // replies the number of fields removed, a hash left empty is deleted.
+  static auto hdel(const Args& args, Buffer& out) -> bool {
+    auto m = args[0];
+    auto& shard = Database::shard(m);
+    Expiration::instance().expire_if_needed(shard, m);
+    auto hash = shard.hsets.find(m);
+    long long n = 0;
+    if (hash != nullptr) {
+      for (size_t i = 1; i < args.size(); ++i) {
+        n += hash->erase(args[i]);
+      }
+      if (hash->empty()) {
+        Database::erase_hash(shard, m);
+      }
+    }
+    Serializer::integer(out, n);
+    return true;
+  }
+
+  static auto hget_all(const Args& args, Buffer& out) -> bool {
+    auto m = args[0];
+
+    auto& shard = Database::shard(m);
+    auto hash = find_key(shard, shard.hsets, m);
+    if (hash == nullptr) {
+      out.append(Serializer::EMPTY_ARRAY);
+      return true;
     }
-    return Value::make_bulk(std::vector<char>(value.begin(), value.end()));
+    Serializer::array(out, hash->size() * 2);
+    hash->for_each([&out](Slice field, Slice value) {
+      Serializer::bulk(out, field);
+      Serializer::bulk(out, value);
+    });
+    return true;
   }
 
-  static auto hset(const std::vector<std::unique_ptr<Value>>& args)
-      -> std::unique_ptr<Value> {
-    if (args.size() < 3) {
-      return Value::make_err("ERR wrong number of arguments for 'hset' command");
+  // the strings a scan call collects, copied so the reply can be written
+  // after the locks they were read under are released.
+  class Batch {
+   public:
+    void clear() {
+      bytes.clear();
+      ends.clear();
     }
-    std::string m(args[0]->bulk.begin(), args[0]->bulk.end());
-    std::string key(args[1]->bulk.begin(), args[1]->bulk.end());
-    std::string value(args[2]->bulk.begin(), args[2]->bulk.end());
 
-    auto hset_ = Database::hsets();
-    {
-      std::lock_guard<std::mutex> guard(hset_.second);
-      hset_.first[m][key] = value;
+    void add(Slice s) {
+      bytes.append(s);
+      ends.push_back(bytes.size());
     }
-    return Value::make_str("OK");
+
+    // replies with the cursor to continue from and the strings.
+    void reply(uint64_t cursor, Buffer& out) const {
+      Serializer::array(out, 2);
+      Serializer::bulk(out, std::to_string(cursor));
+      Serializer::array(out, ends.size());
+      size_t start = 0;
+      for (size_t end : ends) {
+        Serializer::bulk(out, Slice(bytes).substr(start, end - start));
+        start = end;
+      }
+    }
+
+   private:
+    std::string bytes;
+    std::vector<size_t> ends;
+  };
+
+  static auto batch() -> Batch& {
+    thread_local Batch b;
+    b.clear();
+    return b;
   }
 
-  static auto hget(const std::vector<std::unique_ptr<Value>>& args)
-      -> std::unique_ptr<Value> {
-    if (args.size() != 2) {
-      return Value::make_err("ERR wrong number of arguments for 'hget' command");
+  static auto cursor_arg(Slice arg, uint64_t& cursor, Buffer& out) -> bool {
+    cursor = 0;
+    for (char c : arg) {
+      if (c < '0' || c > '9' || cursor > (UINT64_MAX - (c - '0')) / 10) {
+        Serializer::err(out, "ERR invalid cursor");
+        return false;
+      }
+      cursor = cursor * 10 + (c - '0');
+    }
+    if (arg.empty()) {
+      Serializer::err(out, "ERR invalid cursor");
+      return false;
     }
-    std::string m(args[0]->bulk.begin(), args[0]->bulk.end());
-    std::string key(args[1]->bulk.begin(), args[1]->bulk.end());
-    std::string value;
+    return true;
+  }
 
-    auto hset_ = Database::hsets();
-    {
-      std::lock_guard<std::mutex> guard(hset_.second);
-      if (hset_.first.find(m) != hset_.first.end()) {
-        if (hset_.first[m].find(key) != hset_.first[m].end()) {
-          value = hset_.first[m][key];
+  // the [MATCH pattern] [COUNT count] options from args[first] on. an empty
+  // pattern matches everything.
+  static auto scan_options(const Args& args, size_t first, Slice& pattern,
+                           size_t& count, Buffer& out) -> bool {
+    pattern = Slice();
+    count = 10;
+    for (size_t i = first; i < args.size(); i += 2) {
+      if (i + 1 == args.size()) {
+        Serializer::err(out, "ERR syntax error");
+        return false;
+      }
+      if (equals(args[i], "MATCH")) {
+        pattern = args[i + 1] == "*" ? Slice() : args[i + 1];
+      } else if (equals(args[i], "COUNT")) {
+        int64_t n;
+        if (!integer_arg(args[i + 1], n, out)) {
+          return false;
+        }
+        if (n < 1) {
+          Serializer::err(out, "ERR syntax error");
+          return false;
         }
+        count = std::min(static_cast<size_t>(n), SCAN_COUNT_MAX);
+      } else {
+        Serializer::err(out, "ERR syntax error");
+        return false;
       }
     }
-    return Value::make_bulk(std::vector<char>(value.begin(), value.end()));
+    return true;
   }
 
-  static auto hget_all(const std::vector<std::unique_ptr<Value>>& args)
-      -> std::unique_ptr<Value> {
-    if (args.size() != 1) {
-      return Value::make_err("ERR wrong number of arguments for 'hgetall' command");
+  // SCAN cursor [MATCH pattern] [COUNT count]. the low bits of the cursor
+  // pick the shard and which of its dicts is being walked, the bits above
+  // them are the cursor of that dict. a call stops once it has visited
+  // count keys, or ten times as many buckets when they are sparse, and
+  // locks one shard at a time for a single bucket, so it never holds up
+  // other clients for long.
+  static auto scan(const Args& args, Buffer& out) -> bool {
+    uint64_t cursor;
+    Slice pattern;
+    size_t count;
+    if (!cursor_arg(args[0], cursor, out) ||
+        !scan_options(args, 1, pattern, count, out)) {
+      return false;
     }
-    std::string m(args[0]->bulk.begin(), args[0]->bulk.end());
-    std::vector<std::unique_ptr<Value>> values;
+    size_t position = cursor & (SCAN_POSITIONS - 1);
+    uint64_t inner = cursor >> SCAN_POSITION_BITS;
+    auto& keys = batch();
+    size_t visited = 0;
+    size_t steps = count * SCAN_STEPS;
+    while (position < SCAN_POSITIONS && visited < count && steps > 0) {
+      auto& shard = Database::shards()[position >> 1];
+      std::shared_lock<std::shared_mutex> lock(shard.mtx);
+      auto emit = [&](const auto& e) {
+        ++visited;
+        if (!Expiration::expired(shard, e) &&
+            (pattern.empty() || Glob::match(pattern, e.key()))) {
+          keys.add(e.key());
+        }
+      };
+      if (position & 1) {
+        inner = shard.hsets.empty() ? 0 : shard.hsets.scan(inner, emit);
+      } else {
+        inner = shard.sets.empty() ? 0 : shard.sets.scan(inner, emit);
+      }
+      if (inner == 0) {
+        ++position;
+      } else {
+        --steps;
+      }
+    }
+    keys.reply(position == SCAN_POSITIONS
+                   ? 0
+                   : inner << SCAN_POSITION_BITS | position,
+               out);
+    return true;
+  }
+
+  // HSCAN key cursor [MATCH pattern] [COUNT count]. a listpack is small
+  // enough to be returned whole, a table is walked like SCAN walks a dict.
+  static auto hscan(const Args& args, Buffer& out) -> bool {
+    auto m = args[0];
+    uint64_t cursor;
+    Slice pattern;
+    size_t count;
+    if (!cursor_arg(args[1], cursor, out) ||
+        !scan_options(args, 2, pattern, count, out)) {
+      return false;
+    }
+    auto& shard = Database::shard(m);
+    auto hash = find_key(shard, shard.hsets, m);
+    auto& pairs = batch();
+    auto emit = [&pairs, pattern](Slice field, Slice value) {
+      if (pattern.empty() || Glob::match(pattern, field)) {
+        pairs.add(field);
+        pairs.add(value);
+      }
+    };
+    auto table = hash != nullptr ? hash->table() : nullptr;
+    if (table == nullptr) {
+      if (hash != nullptr) {
+        hash->for_each(emit);
+      }
+      pairs.reply(0, out);
+      return true;
+    }
+    size_t visited = 0;
+    Object::Digits digits;
+    for (size_t steps = count * SCAN_STEPS; visited < count && steps > 0; --steps) {
+      cursor = table->scan(cursor, [&](const Hash::Table::Entry& e) {
+        ++visited;
+        emit(e.key(), e.value.view(digits));
+      });
+      if (cursor == 0) {
+        break;
+      }
+    }
+    pairs.reply(cursor, out);
+    return true;
+  }
+
+  static auto bgrewriteaof(const Args& args, Buffer& out) -> bool {
+    if (!Aof::instance().enabled()) {
+      Serializer::err(out, "ERR append only file is disabled");
+      return false;
+    }
+    if (!Aof::instance().rewrite_background()) {
+      Serializer::err(
+          out, "ERR Background append only file rewriting already in progress");
+      return false;
+    }
+    Serializer::str(out, "Background append only file rewriting started");
+    return true;
+  }
+
+  static auto save(const Args& args, Buffer& out) -> bool {
+    if (Snapshot::instance().saving()) {
+      Serializer::err(out, "ERR Background save already in progress");
+      return false;
+    }
+    if (!Snapshot::instance().save()) {
+      Serializer::err(out, "ERR failed to save snapshot");
+      return false;
+    }
+    out.append(Serializer::OK);
+    return true;
+  }
+
+  static auto bgsave(const Args& args, Buffer& out) -> bool {
+    if (!Snapshot::instance().save_background()) {
+      Serializer::err(out, "ERR Background save already in progress");
+      return false;
+    }
+    Serializer::str(out, "Background saving started");
+    return true;
+  }
+
+  // INFO [section ...]: server, clients, memory, persistence, stats,
+  // commandstats and keyspace. without a section, or with default, all but
+  // commandstats; all or everything adds it.
+  static auto info(const Args& args, Buffer& out) -> bool {
+    auto wanted = [&args](Slice section) {
+      if (args.empty()) {
+        return !equals(section, "COMMANDSTATS");
+      }
+      for (auto arg : args) {
+        if (equals(arg, section) || equals(arg, "ALL") ||
+            equals(arg, "EVERYTHING") ||
+            (equals(arg, "DEFAULT") && !equals(section, "COMMANDSTATS"))) {
+          return true;
+        }
+      }
+      return false;
+    };
+    auto& stats = Stats::instance();
+    auto& config = stats.config();
+    std::string s;
+    auto section = [&s](const char* name) {
+      if (!s.empty()) {
+        s += "\r\n";
+      }
+      s += "# ";
+      s += name;
+      s += "\r\n";
+    };
+    auto field = [&s](const char* name, const auto& value) {
+      s += name;
+      s += ':';
+      if constexpr (std::is_arithmetic_v<std::decay_t<decltype(value)>>) {
+        s += std::to_string(value);
+      } else {
+        s += value;
+      }
+      s += "\r\n";
+    };
 
-    auto hset_ = Database::hsets();
-    {
-      std::lock_guard<std::mutex> guard(hset_.second);
-      if (hset_.first.find(m) != hset_.first.end()) {
-        for (auto&& e : hset_.first[m]) {
-          auto v = Value::make_bulk(std::vector<char>(e.first.begin(), e.first.end()));
-          values.push_back(std::move(v));
+    if (wanted("SERVER")) {
+      section("Server");
+      field("youdis_version", YOUDIS_VERSION);
+      field("io_backend", config.io);
+      field("threads", config.threads);
+      field("process_id", static_cast<long long>(getpid()));
+      field("tcp_port", config.port);
+      auto uptime = stats.uptime().count();
+      field("uptime_in_seconds", static_cast<long long>(uptime));
+      field("uptime_in_days", static_cast<long long>(uptime / 86400));
+    }
+    if (wanted("CLIENTS")) {
+      section("Clients");
+      field("connected_clients", stats.total(&Stats::Counters::accepted) -
+                                     stats.total(&Stats::Counters::closed));
+    }
+    if (wanted("MEMORY")) {
+      section("Memory");
+      field("used_memory", Memory::used());
+      field("maxmemory", config.maxmemory);
+      field("maxmemory_policy", config.maxmemoryPolicy);
+    }
+    if (wanted("PERSISTENCE")) {
+      auto& aof = Aof::instance();
+      section("Persistence");
+      field("rdb_bgsave_in_progress", int(Snapshot::instance().saving()));
+      field("aof_enabled", int(aof.enabled()));
+      field("aof_rewrite_in_progress", int(aof.rewrite_in_progress()));
+      if (aof.enabled()) {
+        field("aof_current_size", aof.current_size());
+        field("aof_base_size", aof.base_size());
+      }
+    }
+    if (wanted("STATS")) {
+      section("Stats");
+      field("total_connections_received",
+            stats.total(&Stats::Counters::accepted));
+      field("total_commands_processed", stats.commands());
+      field("instantaneous_ops_per_sec", stats.ops_per_sec());
+      field("total_net_input_bytes", stats.total(&Stats::Counters::netInput));
+      field("total_net_output_bytes",
+            stats.total(&Stats::Counters::netOutput));
+      field("expired_keys", Expiration::instance().expired());
+      field("evicted_keys", Eviction::instance().evicted());
+      field("eventloop_cycles", stats.total(&Stats::Counters::loops));
+      field("eventloop_events", stats.total(&Stats::Counters::events));
+      field("eventloop_duration_sum",
+            stats.total(&Stats::Counters::busyNanos) / 1000);
+      if (config.io == "uring") {
+        field("io_uring_enters", stats.total(&Stats::Counters::syscalls));
+      }
+    }
+    if (wanted("COMMANDSTATS")) {
+      section("Commandstats");
+      std::array<uint64_t, Stats::COMMANDS> calls{};
+      std::array<uint64_t, Stats::COMMANDS> timed{};
+      std::array<uint64_t, Stats::COMMANDS> ticks{};
+      stats.for_each([&](const Stats::Counters& c) {
+        for (size_t i = 0; i < specs().size(); ++i) {
+          calls[i] += c.calls[i].load(std::memory_order_relaxed);
+          timed[i] += c.timed[i].load(std::memory_order_relaxed);
+          ticks[i] += c.ticks[i].load(std::memory_order_relaxed);
         }
+      });
+      for (size_t i = 0; i < specs().size(); ++i) {
+        if (calls[i] == 0) {
+          continue;
+        }
+        std::string name = "cmdstat_";
+        for (char c : specs()[i].name) {
+          name += static_cast<char>(tolower(c));
+        }
+        double usecPerCall =
+            timed[i] ? stats.to_nanos(ticks[i]) / 1000.0 / timed[i] : 0;
+        char value[96];
+        snprintf(value, sizeof(value),
+                 "calls=%llu,usec=%llu,usec_per_call=%.2f",
+                 static_cast<unsigned long long>(calls[i]),
+                 static_cast<unsigned long long>(usecPerCall * calls[i]),
+                 usecPerCall);
+        field(name.c_str(), value);
+      }
+    }
+    if (wanted("KEYSPACE")) {
+      // every shard is locked on its own, for reading its sizes.
+      size_t keys = 0;
+      size_t expires = 0;
+      for (auto& shard : Database::shards()) {
+        std::shared_lock<std::shared_mutex> lock(shard.mtx);
+        keys += shard.sets.size() + shard.hsets.size();
+        expires += shard.expires.size();
+      }
+      section("Keyspace");
+      if (keys > 0) {
+        field("db0", "keys=" + std::to_string(keys) +
+                         ",expires=" + std::to_string(expires));
       }
     }
-    return Value::make_array(std::move(values));
+    Serializer::bulk(out, s);
+    return true;
   }
 };
 
 class Handler {
  public:
-  static auto handle(std::unique_ptr<resp::Value>&& request) -> std::vector<char> {
-    auto req = Serializer::marshal(*request);
-    static Aof aof;
-    if (request->type != types::ARRAY) {
-      throw std::runtime_error("invalid request type, expected array");
+  // runs a request and serializes its reply into out.
+  static void handle(const Request& request, Buffer& out) {
+    auto spec = find(request, out);
+    if (spec == nullptr) {
+      return;
     }
-
-    if (request->array.empty()) {
-      throw std::runtime_error("invalid request type, expected array length > 0");
-      return {};
+    // eviction locks the shards it evicts from itself, so it runs before
+    // the command holds any.
+    if ((spec->flags & Command::DENYOOM) &&
+        !Eviction::instance().make_room()) {
+      out.append(
+          "-OOM command not allowed when used memory > 'maxmemory'.\r\n");
+      return;
     }
+    Args args(request.argv + 1, request.argc - 1);
+    auto& stats = Stats::local();
+    size_t i = Command::position(*spec);
+    bool timed = stats.calls[i].load(std::memory_order_relaxed) %
+                     Stats::TIME_EVERY ==
+                 0;
+    uint64_t start = timed ? Stats::ticks() : 0;
+    Database::Guard guard(Command::shards(*spec, request),
+                          spec->flags & Command::WRITE);
+    bool ok = spec->handler(args, out);
+    Stats::bump(stats.calls[i]);
+    if (timed) {
+      Stats::bump(stats.timed[i]);
+      Stats::bump(stats.ticks[i], Stats::ticks() - start);
+    }
+    // only writes that went through change the dataset, they are saved as
+    // the frame the client sent while the keys are still locked, so the aof
+    // keeps the order in which writes to the same key were applied.
+    if ((spec->flags & Command::WRITE) && ok) {
+      auto& rewritten = Command::rewritten();
+      if (rewritten.empty()) {
+        Aof::instance().save(request.frame);
+      } else {
+        Aof::instance().save(rewritten);
+        rewritten.clear();
+      }
+    }
+  }
 
-    std::string cmdStr;
-    std::transform(request->array[0]->bulk.begin(), request->array[0]->bulk.end(),
-                   std::back_inserter(cmdStr), toupper);
-
-    std::vector<std::unique_ptr<Value>> args;
-    for (auto i = request->array.begin() + 1; i != request->array.end(); ++i) {
-      args.push_back(std::move(*i));
+  // applies a command read back from the aof, without saving it again.
+  static void replay(const Request& request) {
+    // replay runs before the reactors start, the replies are discarded.
+    static Buffer discarded;
+    auto spec = find(request, discarded);
+    if (spec == nullptr) {
+      throw std::runtime_error("invalid command '" +
+                               std::string(request.argv[0]) + "'");
     }
+    Args args(request.argv + 1, request.argc - 1);
+    Database::Guard guard(Command::shards(*spec, request),
+                          spec->flags & Command::WRITE);
+    spec->handler(args, discarded);
+    discarded.clear();
+    Command::rewritten().clear();
+  }
 
-    auto reply = Command::cmds()[cmdStr](args);
-    auto reply_ = Serializer::marshal(*reply);
-    aof.save(req);
-    return reply_;
+ private:
+  // the command of a request, or nullptr after replying with an error when
+  // it is unknown or has the wrong number of arguments.
+  static auto find(const Request& request, Buffer& out)
+      -> const Command::Spec* {
+    auto name = request.argv[0];
+    auto spec = Command::lookup(name);
+    if (spec == nullptr) {
+      out.append("-ERR unknown command '");
+      out.append(name);
+      out.append("'\r\n");
+      return nullptr;
+    }
+    if (!Command::arity_ok(*spec, request.argc)) {
+      out.append("-ERR wrong number of arguments for '");
+      for (char c : spec->name) {
+        out.append(static_cast<char>(tolower(c)));
+      }
+      out.append("' command\r\n");
+      return nullptr;
+    }
+    return spec;
   }
 };
 
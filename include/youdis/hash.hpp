@@ -0,0 +1,325 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string_view>
+
+#include "youdis/dict.hpp"
+#include "youdis/memory.hpp"
+#include "youdis/object.hpp"
+
+namespace resp {
+// the value of a hash key, as small as a pointer. small hashes are a
+// listpack: one heap block holding the fields and values back to back, each
+// prefixed with its length, which a lookup scans. once a hash outgrows the
+// configured number of fields or length of a field or value it is converted
+// to a Dict for good.
+class Hash {
+ public:
+  using Table = Dict<Object>;
+
+  Hash() : bits(0) {}
+
+  Hash(const Hash&) = delete;
+  Hash& operator=(const Hash&) = delete;
+
+  ~Hash() { release(); }
+
+  // the thresholds past which hashes are converted to a table.
+  static void configure(size_t maxEntries, size_t maxValue) {
+    limits().entries = maxEntries;
+    limits().value = maxValue;
+  }
+
+  auto size() const -> size_t {
+    if (auto t = table()) {
+      return t->size();
+    }
+    return block() ? header()->count : 0;
+  }
+
+  auto empty() const -> bool { return size() == 0; }
+
+  // the dict of a converted hash, nullptr while it is a listpack.
+  auto table() const -> const Table* {
+    return bits & TABLE ? reinterpret_cast<const Table*>(bits & ~TABLE)
+                        : nullptr;
+  }
+
+  auto table() -> Table* {
+    return bits & TABLE ? reinterpret_cast<Table*>(bits & ~TABLE) : nullptr;
+  }
+
+  // points value at the value of field, which stays valid until the hash
+  // changes. digits holds an integer encoded value of a table.
+  auto find(std::string_view field, std::string_view& value,
+            Object::Digits& digits) const -> bool {
+    if (auto t = table()) {
+      auto v = t->find(field);
+      if (v == nullptr) {
+        return false;
+      }
+      value = v->view(digits);
+      return true;
+    }
+    Cursor c(*this);
+    while (c.next()) {
+      if (c.field == field) {
+        value = c.value;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // converts the hash now if adding up to n fields, or a field or value of
+  // longest bytes, would take it past the listpack limits. batches call it
+  // first so they run against one encoding.
+  void reserve(size_t n, size_t longest = 0) {
+    if (table() == nullptr &&
+        (size() + n > limits().entries || longest > limits().value)) {
+      convert(size() + n);
+    }
+  }
+
+  // the same for adding the fields field(0) .. field(n - 1), of which only
+  // those the listpack lacks are counted, so overwriting fields never
+  // converts it.
+  template <class F>
+  void reserve(size_t n, F&& field, size_t longest) {
+    if (table() != nullptr ||
+        (size() + n <= limits().entries && longest <= limits().value)) {
+      return;
+    }
+    if (longest <= limits().value) {
+      size_t fresh = 0;
+      std::string_view value;
+      Object::Digits digits;
+      for (size_t i = 0; i < n && size() + fresh <= limits().entries; ++i) {
+        fresh += !find(field(i), value, digits);
+      }
+      if (size() + fresh <= limits().entries) {
+        return;
+      }
+    }
+    convert(size() + n);
+  }
+
+  // sets field to value, returns whether the field is new.
+  auto set(std::string_view field, std::string_view value) -> bool {
+    if (table() == nullptr &&
+        std::max(field.size(), value.size()) > limits().value) {
+      convert(size() + 1);
+    }
+    if (auto t = table()) {
+      auto [v, inserted] = t->insert(field);
+      v->assign(value);
+      return inserted;
+    }
+    size_t entry = encoded(field.size()) + field.size() +
+                   encoded(value.size()) + value.size();
+    Cursor c(*this);
+    while (c.next()) {
+      if (c.field == field) {
+        // the new pair takes the place of the old one.
+        size_t at = c.start - data();
+        splice(at, c.end - c.start, entry);
+        write(data() + at, field, value);
+        return false;
+      }
+    }
+    size_t at = block() ? header()->len : 0;
+    splice(at, 0, entry);
+    write(data() + at, field, value);
+    if (++header()->count > limits().entries) {
+      convert(size());
+    }
+    return true;
+  }
+
+  auto erase(std::string_view field) -> bool {
+    if (auto t = table()) {
+      return t->erase(field);
+    }
+    Cursor c(*this);
+    while (c.next()) {
+      if (c.field == field) {
+        splice(c.start - data(), c.end - c.start, 0);
+        --header()->count;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // calls f(field, value) for every field.
+  template <class F>
+  void for_each(F&& f) const {
+    if (auto t = table()) {
+      Object::Digits digits;
+      t->for_each([&](std::string_view field, const Object& value) {
+        f(field, value.view(digits));
+      });
+      return;
+    }
+    Cursor c(*this);
+    while (c.next()) {
+      f(c.field, c.value);
+    }
+  }
+
+ private:
+  struct Limits {
+    size_t entries = 128;
+    size_t value = 64;
+  };
+
+  // the listpack block starts with this, the pairs follow.
+  struct Header {
+    uint32_t count;
+    // bytes of pairs.
+    uint32_t len;
+  };
+
+  // walks the pairs of a listpack.
+  struct Cursor {
+    explicit Cursor(const Hash& hash)
+        : p(hash.block() ? hash.data() : nullptr),
+          stop(p ? p + hash.header()->len : nullptr) {}
+
+    auto next() -> bool {
+      if (p == stop) {
+        return false;
+      }
+      start = p;
+      field = read(p);
+      value = read(p);
+      end = p;
+      return true;
+    }
+
+    const char* p;
+    const char* stop;
+    const char* start;
+    const char* end;
+    std::string_view field;
+    std::string_view value;
+  };
+
+  // bit 0 tells a table from a listpack block, allocations are aligned so
+  // it is never part of the pointer.
+  static constexpr uintptr_t TABLE = 1;
+
+  static auto limits() -> Limits& {
+    static Limits l;
+    return l;
+  }
+
+  auto block() const -> char* { return reinterpret_cast<char*>(bits); }
+  auto header() const -> Header* { return reinterpret_cast<Header*>(block()); }
+  auto data() const -> char* { return block() + sizeof(Header); }
+
+  // lengths are stored as varints, 7 bits a byte.
+  static auto encoded(size_t n) -> size_t {
+    size_t bytes = 1;
+    while (n >= 0x80) {
+      n >>= 7;
+      ++bytes;
+    }
+    return bytes;
+  }
+
+  static auto read(const char*& p) -> std::string_view {
+    size_t n = 0;
+    for (int shift = 0;; shift += 7) {
+      auto byte = static_cast<uint8_t>(*p++);
+      n |= size_t(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        break;
+      }
+    }
+    std::string_view s(p, n);
+    p += n;
+    return s;
+  }
+
+  static void write(char* p, std::string_view field, std::string_view value) {
+    for (auto s : {field, value}) {
+      size_t n = s.size();
+      while (n >= 0x80) {
+        *p++ = static_cast<char>(n | 0x80);
+        n >>= 7;
+      }
+      *p++ = static_cast<char>(n);
+      std::memcpy(p, s.data(), s.size());
+      p += s.size();
+    }
+  }
+
+  // replaces the removed bytes at offset at with room for added ones,
+  // sizing the block to fit exactly.
+  void splice(size_t at, size_t removed, size_t added) {
+    size_t len = block() ? header()->len : 0;
+    size_t tail = len - at - removed;
+    size_t newLen = len - removed + added;
+    if (added < removed) {
+      std::memmove(data() + at + added, data() + at + removed, tail);
+    }
+    if (block() == nullptr || newLen != len) {
+      resize(newLen);
+    }
+    if (added > removed) {
+      std::memmove(data() + at + added, data() + at + removed, tail);
+    }
+    header()->len = static_cast<uint32_t>(newLen);
+  }
+
+  void resize(size_t len) {
+    char* old = block();
+    if (old != nullptr) {
+      Memory::freed(old);
+    }
+    void* p = std::realloc(old, sizeof(Header) + len);
+    if (p == nullptr) {
+      if (old != nullptr) {
+        Memory::allocated(old);
+      }
+      throw std::bad_alloc();
+    }
+    Memory::allocated(p);
+    if (old == nullptr) {
+      static_cast<Header*>(p)->count = 0;
+    }
+    bits = reinterpret_cast<uintptr_t>(p);
+  }
+
+  // moves the pairs into a table sized for n fields.
+  void convert(size_t n) {
+    auto t = new Table();
+    Memory::allocated(t);
+    t->reserve(n);
+    Cursor c(*this);
+    while (c.next()) {
+      t->insert(c.field).first->assign(c.value);
+    }
+    release();
+    bits = reinterpret_cast<uintptr_t>(t) | TABLE;
+  }
+
+  void release() {
+    if (auto t = table()) {
+      Memory::freed(t);
+      delete t;
+    } else if (block() != nullptr) {
+      Memory::freed(block());
+      std::free(block());
+    }
+    bits = 0;
+  }
+
+  uintptr_t bits;
+};
+};  // namespace resp
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+namespace resp {
+// an hdr style histogram of latencies in nanoseconds: values below 128 get
+// a bucket each, above that every power of two is split into 64 buckets, so
+// any value is recorded within 1.6% at a fixed 30KB whatever the range.
+class Histogram {
+ public:
+  void record(uint64_t v) {
+    ++counts[index(v)];
+    ++total;
+    sum += v;
+    largest = std::max(largest, v);
+  }
+
+  void merge(const Histogram& other) {
+    for (size_t i = 0; i < BUCKETS; ++i) {
+      counts[i] += other.counts[i];
+    }
+    total += other.total;
+    sum += other.sum;
+    largest = std::max(largest, other.largest);
+  }
+
+  auto count() const -> uint64_t { return total; }
+  auto max() const -> uint64_t { return largest; }
+  auto mean() const -> double { return total ? double(sum) / total : 0; }
+
+  // the value below which p percent of the recorded ones are, as the
+  // highest value of the bucket it falls in.
+  auto percentile(double p) const -> uint64_t {
+    if (total == 0) {
+      return 0;
+    }
+    auto rank = static_cast<uint64_t>(p / 100 * total + 0.5);
+    rank = std::clamp<uint64_t>(rank, 1, total);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+      seen += counts[i];
+      if (seen >= rank) {
+        return std::min(highest(i), largest);
+      }
+    }
+    return largest;
+  }
+
+ private:
+  static constexpr int SUB_BITS = 7;
+  static constexpr uint64_t SUB = uint64_t(1) << SUB_BITS;
+  static constexpr uint64_t HALF = SUB / 2;
+  // the largest shift is that of a value with bit 63 set.
+  static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * HALF + SUB;
+
+  static auto index(uint64_t v) -> size_t {
+    if (v < SUB) {
+      return v;
+    }
+    // shifted right by this, v falls in [HALF, SUB).
+    int shift = 64 - __builtin_clzll(v) - SUB_BITS;
+    return shift * HALF + (v >> shift);
+  }
+
+  static auto highest(size_t i) -> uint64_t {
+    if (i < SUB) {
+      return i;
+    }
+    int shift = static_cast<int>(i / HALF - 1);
+    uint64_t sub = i % HALF + HALF;
+    return ((sub + 1) << shift) - 1;
+  }
+
+  std::array<uint64_t, BUCKETS> counts{};
+  uint64_t total = 0;
+  uint64_t sum = 0;
+  uint64_t largest = 0;
+};
+};  // namespace resp
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <malloc.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace resp {
+// the bytes held by the dataset: dict entries, bucket arrays and value
+// buffers, counted at the size the allocator actually reserved for them.
+// each thread counts into a cache line of its own and used() adds the lines
+// up, so the write path never contends on a shared counter. a thread may
+// free what another allocated, only the sum is meaningful.
+class Memory {
+ public:
+  static void allocated(void* p) { add(static_cast<int64_t>(usable(p))); }
+  static void freed(void* p) { add(-static_cast<int64_t>(usable(p))); }
+
+  static auto used() -> size_t {
+    int64_t sum = 0;
+    size_t n = registered().load(std::memory_order_acquire);
+    for (size_t i = 0; i < n && i < SLOTS; ++i) {
+      sum += slots()[i].bytes.load(std::memory_order_relaxed);
+    }
+    return sum > 0 ? static_cast<size_t>(sum) : 0;
+  }
+
+ private:
+  static constexpr size_t SLOTS = 256;
+
+  struct alignas(64) Slot {
+    std::atomic<int64_t> bytes{0};
+  };
+
+  static auto usable(void* p) -> size_t { return malloc_usable_size(p); }
+
+  static void add(int64_t n) {
+    // threads beyond SLOTS share slots, hence the atomic add.
+    thread_local auto& slot =
+        slots()[registered().fetch_add(1, std::memory_order_acq_rel) % SLOTS];
+    slot.bytes.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  static auto slots() -> std::array<Slot, SLOTS>& {
+    static std::array<Slot, SLOTS> s;
+    return s;
+  }
+
+  static auto registered() -> std::atomic<size_t>& {
+    static std::atomic<size_t> n{0};
+    return n;
+  }
+};
+};  // namespace resp
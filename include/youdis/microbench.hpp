@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "youdis/config.hpp"
+
+namespace resp {
+// keeps the compiler from optimizing away a value a benchmark computes.
+template <class T>
+inline void keep(const T& value) {
+  asm volatile("" : : "r"(&value) : "memory");
+}
+
+struct MicrobenchConfig {
+  // csv or json.
+  std::string format = "csv";
+  // only cases whose name contains this run.
+  std::string filter;
+  // timed runs of each case, the median is reported.
+  int repetitions = 5;
+  // roughly how long each timed run takes, in seconds.
+  double runTime = 0.1;
+  // the key counts the database cases run at.
+  std::vector<uint64_t> sizes = {1000, 1000000, 10000000};
+
+  // the cases to run and how, as given on the command line.
+  static auto parse(int argc, char** argv) -> MicrobenchConfig {
+    MicrobenchConfig config;
+    for_each_option(argc, argv, [&config](const std::string& name,
+                                          const std::string& value) {
+      if (name == "--format") {
+        if (value != "csv" && value != "json") {
+          throw std::invalid_argument("--format must be csv or json");
+        }
+        config.format = value;
+      } else if (name == "--filter") {
+        config.filter = value;
+      } else if (name == "--repetitions") {
+        config.repetitions = std::stoi(value);
+        if (config.repetitions <= 0) {
+          throw std::invalid_argument("--repetitions must be positive");
+        }
+      } else if (name == "--run-time") {
+        config.runTime = std::stod(value);
+        if (config.runTime <= 0) {
+          throw std::invalid_argument("--run-time must be positive");
+        }
+      } else if (name == "--sizes") {
+        config.sizes.clear();
+        size_t start = 0;
+        while (start < value.size()) {
+          size_t end = std::min(value.find(',', start), value.size());
+          config.sizes.push_back(std::stoull(value.substr(start, end - start)));
+          start = end + 1;
+        }
+      } else {
+        throw std::invalid_argument("unknown option " + name);
+      }
+    });
+    return config;
+  }
+};
+
+// times cases and prints one line per case as it finishes. a case is warmed
+// up and calibrated to a batch of iterations that takes about runTime, then
+// timed over repetitions batches: the median ns per operation is the
+// result, min and max show how stable it was.
+class Microbench {
+ public:
+  explicit Microbench(const MicrobenchConfig& config_) : config(config_) {
+    if (config.format == "csv") {
+      printf("name,ops,ns_per_op,min_ns_per_op,max_ns_per_op\n");
+    } else {
+      printf("[");
+    }
+  }
+
+  Microbench(const Microbench&) = delete;
+  Microbench& operator=(const Microbench&) = delete;
+
+  ~Microbench() {
+    if (config.format == "json") {
+      printf("\n]\n");
+    }
+  }
+
+  auto enabled(const std::string& name) const -> bool {
+    return name.find(config.filter) != std::string::npos;
+  }
+
+  // times f(), which does ops operations per call.
+  template <class F>
+  void run(const std::string& name, uint64_t ops, F&& f) {
+    if (!enabled(name)) {
+      return;
+    }
+    // doubling the batch until it takes a tenth of the run time warms the
+    // caches and branch predictors and finds the batch size.
+    uint64_t batch = 1;
+    while (time(batch, f) < config.runTime / 10) {
+      batch *= 2;
+    }
+    batch = std::max<uint64_t>(
+        1, static_cast<uint64_t>(batch * config.runTime /
+                                 std::max(time(batch, f), 1e-9)));
+    std::vector<double> nsPerOp;
+    for (int i = 0; i < config.repetitions; ++i) {
+      nsPerOp.push_back(time(batch, f) * 1e9 / (batch * ops));
+    }
+    report(name, batch * ops, nsPerOp);
+  }
+
+  // times a single call of f, which does ops operations, for work that
+  // cannot be repeated such as filling a table.
+  template <class F>
+  void once(const std::string& name, uint64_t ops, F&& f) {
+    if (!enabled(name)) {
+      return;
+    }
+    report(name, ops, {time(1, f) * 1e9 / ops});
+  }
+
+ private:
+  template <class F>
+  static auto time(uint64_t batch, F& f) -> double {
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < batch; ++i) {
+      f();
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+  }
+
+  void report(const std::string& name, uint64_t ops,
+              std::vector<double> nsPerOp) {
+    std::sort(nsPerOp.begin(), nsPerOp.end());
+    double median = nsPerOp[nsPerOp.size() / 2];
+    if (config.format == "csv") {
+      printf("%s,%llu,%.2f,%.2f,%.2f\n", name.c_str(),
+             static_cast<unsigned long long>(ops), median, nsPerOp.front(),
+             nsPerOp.back());
+    } else {
+      printf("%s\n  {\"name\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.2f, "
+             "\"min_ns_per_op\": %.2f, \"max_ns_per_op\": %.2f}",
+             first ? "" : ",", name.c_str(),
+             static_cast<unsigned long long>(ops), median, nsPerOp.front(),
+             nsPerOp.back());
+      first = false;
+    }
+    fflush(stdout);
+  }
+
+  const MicrobenchConfig& config;
+  bool first = true;
+};
+};  // namespace resp
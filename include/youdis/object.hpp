@@ -0,0 +1,190 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include "youdis/memory.hpp"
+
+namespace resp {
+// a compact string value of 16 bytes. values that read as a canonical 64 bit
+// integer are stored as the integer, strings of up to 15 bytes are embedded,
+// longer ones live in an exactly sized heap block.
+class Object {
+ public:
+  enum Encoding : uint8_t { EMBSTR = 0, INT = 1, RAW = 2 };
+
+  static constexpr size_t EMBSTR_MAX = 15;
+  // small integers are read back from a shared table instead of being
+  // formatted on every access.
+  static constexpr int64_t SHARED_INTEGERS = 10000;
+
+  // room to format an integer encoded value.
+  struct Digits {
+    char data[24];
+  };
+
+  Object() { bytes[TAG] = 0; }
+
+  Object(const Object&) = delete;
+  Object& operator=(const Object&) = delete;
+
+  ~Object() { release(); }
+
+  auto encoding() const -> Encoding {
+    return static_cast<Encoding>(static_cast<uint8_t>(bytes[TAG]) >> 6);
+  }
+
+  void assign(std::string_view s) {
+    int64_t n;
+    if (parse_int(s, n)) {
+      release();
+      std::memcpy(bytes, &n, sizeof(n));
+      bytes[TAG] = static_cast<char>(INT << 6);
+    } else if (s.size() <= EMBSTR_MAX) {
+      release();
+      std::memcpy(bytes, s.data(), s.size());
+      bytes[TAG] = static_cast<char>(s.size());
+    } else if (encoding() == RAW && raw_len() == s.size()) {
+      std::memcpy(raw_ptr(), s.data(), s.size());
+    } else {
+      release();
+      char* p = new char[s.size()];
+      Memory::allocated(p);
+      std::memcpy(p, s.data(), s.size());
+      uint32_t len = static_cast<uint32_t>(s.size());
+      std::memcpy(bytes, &p, sizeof(p));
+      std::memcpy(bytes + sizeof(p), &len, sizeof(len));
+      bytes[TAG] = static_cast<char>(RAW << 6);
+    }
+  }
+
+  auto integer() const -> int64_t {
+    int64_t n;
+    std::memcpy(&n, bytes, sizeof(n));
+    return n;
+  }
+
+  // the value as a string, integers are formatted into digits unless they
+  // are small enough to come from the shared table.
+  auto view(Digits& digits) const -> std::string_view {
+    switch (encoding()) {
+      case INT:
+        return format(integer(), digits);
+      case RAW:
+        return std::string_view(raw_ptr(), raw_len());
+      default:
+        return std::string_view(bytes, static_cast<uint8_t>(bytes[TAG]) & 0xf);
+    }
+  }
+
+  // heap bytes owned beyond the object itself.
+  auto allocated() const -> size_t { return encoding() == RAW ? raw_len() : 0; }
+
+  // accepts exactly the strings an int64 prints as, so the value reads back
+  // byte for byte.
+  static auto parse_int(std::string_view s, int64_t& out) -> bool {
+    if (s.empty() || s.size() > 20) {
+      return false;
+    }
+    size_t i = 0;
+    bool negative = s[0] == '-';
+    if (negative) {
+      ++i;
+    }
+    if (i == s.size() || (s[i] == '0' && s.size() > 1)) {
+      return false;
+    }
+    uint64_t n = 0;
+    for (; i < s.size(); ++i) {
+      if (s[i] < '0' || s[i] > '9') {
+        return false;
+      }
+      uint64_t d = static_cast<uint64_t>(s[i] - '0');
+      if (n > (UINT64_MAX - d) / 10) {
+        return false;
+      }
+      n = n * 10 + d;
+    }
+    uint64_t limit = negative ? uint64_t(INT64_MAX) + 1 : uint64_t(INT64_MAX);
+    if (n > limit) {
+      return false;
+    }
+    out = negative ? static_cast<int64_t>(0 - n) : static_cast<int64_t>(n);
+    return true;
+  }
+
+  // the decimal form of n, in digits or the shared table.
+  static auto format(int64_t n, Digits& digits) -> std::string_view {
+    if (n >= 0 && n < SHARED_INTEGERS) {
+      auto& shared = shared_integers()[n];
+      return std::string_view(shared.data() + 1, shared[0]);
+    }
+    char* end = digits.data + sizeof(digits.data);
+    char* p = end;
+    uint64_t u = static_cast<uint64_t>(n);
+    if (n < 0) {
+      u = 0 - u;
+    }
+    do {
+      *--p = static_cast<char>('0' + u % 10);
+      u /= 10;
+    } while (u != 0);
+    if (n < 0) {
+      *--p = '-';
+    }
+    return std::string_view(p, end - p);
+  }
+
+ private:
+  static constexpr size_t TAG = 15;
+
+  // "0" to "9999", each prefixed with its length.
+  static auto shared_integers()
+      -> const std::array<std::array<char, 5>, SHARED_INTEGERS>& {
+    static const auto table = []() {
+      std::array<std::array<char, 5>, SHARED_INTEGERS> t{};
+      for (int64_t n = 0; n < SHARED_INTEGERS; ++n) {
+        char digits[4];
+        int len = 0;
+        int64_t u = n;
+        do {
+          digits[len++] = static_cast<char>('0' + u % 10);
+          u /= 10;
+        } while (u != 0);
+        t[n][0] = static_cast<char>(len);
+        for (int i = 0; i < len; ++i) {
+          t[n][1 + i] = digits[len - 1 - i];
+        }
+      }
+      return t;
+    }();
+    return table;
+  }
+
+  auto raw_ptr() const -> char* {
+    char* p;
+    std::memcpy(&p, bytes, sizeof(p));
+    return p;
+  }
+
+  auto raw_len() const -> uint32_t {
+    uint32_t len;
+    std::memcpy(&len, bytes + sizeof(char*), sizeof(len));
+    return len;
+  }
+
+  void release() {
+    if (encoding() == RAW) {
+      Memory::freed(raw_ptr());
+      delete[] raw_ptr();
+      bytes[TAG] = 0;
+    }
+  }
+
+  // embedded bytes, the integer, or the heap pointer and length; the last
+  // byte is the tag: encoding in the top two bits, embedded length below.
+  alignas(8) char bytes[16];
+};
+};  // namespace resp
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+namespace resp {
+// a fast per thread xorshift generator for sampling keys, not for anything
+// that needs real randomness.
+inline auto random64() -> uint64_t {
+  // seeded from its own address so every thread draws differently.
+  thread_local uint64_t state =
+      0x9e3779b97f4a7c15ull ^ reinterpret_cast<uintptr_t>(&state);
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+};  // namespace resp
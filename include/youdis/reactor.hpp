@@ -0,0 +1,197 @@
+#pragma once
+
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "epoll.hpp"
+#include "socket.hpp"
+#include "utils.hpp"
+#include "youdis/arena.hpp"
+#include "youdis/client.hpp"
+#include "youdis/config.hpp"
+#include "youdis/cron.hpp"
+#include "youdis/handle.hpp"
+#include "youdis/resp.hpp"
+#include "youdis/stats.hpp"
+
+namespace resp {
+// one event loop with its own listening socket and clients. every reactor
+// binds the same address with SO_REUSEPORT, so the kernel spreads incoming
+// connections across them and a connection stays on one thread for its
+// whole life.
+class Reactor {
+ public:
+  Reactor(const Config& config, int id_)
+      : cron(id_, config.threads), queryLimit(config.clientQueryBufferLimit) {
+    server.create(AF_INET, SOCK_STREAM);
+    server.reuse_port();
+    server.bind_(config.bind.c_str(), config.port);
+    server.set_nonblocking();
+    server.listen_(config.tcpBacklog);
+    epoll.add_socket(server.raw_fd(), EPOLLIN | EPOLLET);
+  }
+
+  Reactor(const Reactor&) = delete;
+  Reactor& operator=(const Reactor&) = delete;
+
+  void run() {
+    std::vector<epoll_event> events(EVENTS_MIN);
+    Request request;
+    Arena& arena = Arena::local();
+    auto& stats = Stats::local();
+
+    while (true) {
+      // sleeps no longer than until the next timer is due, and not at all
+      // while clients have input left over from the last pass.
+      int numEvents = epoll.wait(events, unread.empty() ? cron.timeout() : 0);
+      auto start = std::chrono::steady_clock::now();
+      Stats::bump(stats.loops);
+      Stats::bump(stats.events, numEvents);
+      for (int i = 0; i < numEvents; ++i) {
+        int fd = events[i].data.fd;
+
+        // connections, all of the backlog since the edge only fires again
+        // for new arrivals.
+        if (fd == server.raw_fd()) {
+          accept();
+          continue;
+        }
+
+        serve(fd, clients.at(fd), events[i].events & EPOLLOUT,
+              events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR), request,
+              arena);
+      }
+      // clients that hit their read budget last pass go on reading, their
+      // edge has fired already.
+      retry.swap(unread);
+      for (int fd : retry) {
+        auto it = clients.find(fd);
+        if (it != clients.end()) {
+          serve(fd, it->second, false, true, request, arena);
+        }
+      }
+      retry.clear();
+
+      // group commit: the writes of this iteration reach the aof before any
+      // of their replies leave. clients whose socket is full get EPOLLOUT
+      // until their replies are out.
+      Aof::instance().flush();
+      for (int fd : pending) {
+        auto it = clients.find(fd);
+        if (it == clients.end()) {
+          continue;
+        }
+        try {
+          flush(fd, it->second);
+        } catch (const std::exception& e) {
+          drop(fd);
+          error() << e.what() << std::endl;
+        }
+      }
+      pending.clear();
+      // a full batch means more events were ready than fit, so the next
+      // wait takes more.
+      if (numEvents == static_cast<int>(events.size()) &&
+          events.size() < EVENTS_MAX) {
+        events.resize(events.size() * 2);
+      }
+      // nothing parsed in this iteration is referenced anymore.
+      arena.reset();
+
+      cron.run();
+      Stats::bump(stats.busyNanos,
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count());
+    }
+  }
+
+ private:
+  static constexpr size_t EVENTS_MIN = 64;
+  static constexpr size_t EVENTS_MAX = 4096;
+
+  // flushes and reads for a ready client. every complete request read is
+  // handled, a trailing partial frame stays buffered until the next read.
+  void serve(int fd, Client& client, bool writable, bool readable,
+             Request& request, Arena& arena) {
+    try {
+      if (writable) {
+        flush(fd, client);
+      }
+      if (readable) {
+        bool open = client.read();
+        while (client.next(request, arena)) {
+          Handler::handle(request, client.output());
+        }
+        if (!open) {
+          throw SocketClose("socket disconnected.");
+        }
+        if (client.overflowed()) {
+          throw std::runtime_error(
+              "closing client that reached the query buffer limit.");
+        }
+        pending.push_back(fd);
+        if (client.more()) {
+          unread.push_back(fd);
+        }
+      }
+    } catch (const SocketClose& e) {
+      drop(fd);
+    } catch (const std::exception& e) {
+      drop(fd);
+      error() << e.what() << std::endl;
+    }
+  }
+
+  void accept() {
+    while (true) {
+      int cfd;
+      try {
+        cfd = server.accept_nonblocking();
+      } catch (const std::exception& e) {
+        // out of fds most likely, the rest waits for the next edge.
+        error() << e.what() << std::endl;
+        return;
+      }
+      if (cfd == -1) {
+        return;
+      }
+      clients.try_emplace(cfd, cfd, queryLimit);
+      epoll.add_socket(cfd, EPOLLIN | EPOLLET);
+      Stats::bump(Stats::local().accepted);
+    }
+  }
+
+  void drop(int fd) {
+    epoll.remove_socket(fd);
+    clients.erase(fd);
+    Stats::bump(Stats::local().closed);
+  }
+
+  // sends what the client has queued, watching EPOLLOUT only while some of
+  // it is left.
+  void flush(int fd, Client& client) {
+    bool done = client.flush();
+    if (done == client.watching()) {
+      client.watch(!done);
+      epoll.modify_socket(fd, done ? EPOLLIN | EPOLLET
+                                   : EPOLLIN | EPOLLOUT | EPOLLET);
+    }
+  }
+
+  Cron cron;
+  size_t queryLimit;
+  Socket server;
+  Epoll epoll;
+  std::unordered_map<int, Client> clients;
+  // clients with replies queued during the current iteration.
+  std::vector<int> pending;
+  // clients whose last read stopped on its budget, and those being read
+  // again in this iteration.
+  std::vector<int> unread;
+  std::vector<int> retry;
+};
+};  // namespace resp
@@ -3,8 +3,12 @@
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "youdis/arena.hpp"
+#include "youdis/buffer.hpp"
+
 namespace resp {
 struct types {
   static constexpr char STRING = '+';
@@ -116,14 +120,25 @@ class GeneralParser {
   Readable& reader;
 };
 
+// thrown by Parser when the buffer ends in the middle of a value; the caller
+// is expected to wait for more bytes and retry from the same offset.
+class Incomplete : public std::runtime_error {
+ public:
+  Incomplete() : std::runtime_error("incomplete resp value.") {}
+};
+
 class Parser {
  public:
-  Parser(const std::vector<char>& buffer) : buf(buffer), it(buf.begin()) {}
+  Parser(const std::vector<char>& buffer)
+      : Parser(buffer.data(), buffer.size()) {}
+
+  Parser(const char* data, size_t size)
+      : begin(data), end(data + size), it(data) {}
 
   auto parse() -> std::unique_ptr<Value> {
     char type;
     if (!read_byte(type)) {
-      throw std::runtime_error("failed to parse resp value.");
+      throw Incomplete();
     }
     if (type == types::ARRAY) {
       return read_array();
@@ -134,13 +149,16 @@ class Parser {
     throw std::runtime_error("unknown resp value type.");
   }
 
-  void reset() { it = buf.begin(); }
+  // number of bytes consumed by the values parsed so far.
+  auto offset() const -> size_t { return it - begin; }
+
+  void reset() { it = begin; }
 
  private:
   auto read_num() -> int {
     std::vector<char> line;
     if (!readline(line)) {
-      throw std::runtime_error("failed to read number.");
+      throw Incomplete();
     }
     return stoi(std::string(line.begin(), line.end()));
   }
@@ -162,15 +180,14 @@ class Parser {
 
     int len = read_num();
     val->bulk.resize(len);
-    if (!read_n(val->bulk, len)) {
-      throw std::runtime_error("failed to read bulk.");
+    if (!read_n(val->bulk, len) || !readline()) {
+      throw Incomplete();
     }
-    readline();
     return val;
   }
 
   auto read_byte(char& byte) -> bool {
-    if (it == buf.end()) {
+    if (it == end) {
       return false;
     }
     byte = *it;
@@ -180,7 +197,7 @@ class Parser {
 
   auto readline() -> bool {
     char pre = '\0';
-    for (; it != buf.end(); ++it) {
+    for (; it != end; ++it) {
       if (*it == '\n' && pre == '\r') {
         ++it;
         return true;
@@ -192,8 +209,8 @@ class Parser {
 
   auto readline(std::vector<char>& line) -> bool {
     line.clear();
-    for (; it != buf.end(); ++it) {
-      if (*it == '\n' && line.back() == '\r') {
+    for (; it != end; ++it) {
+      if (*it == '\n' && !line.empty() && line.back() == '\r') {
         line.pop_back();
         ++it;
         return true;
@@ -204,87 +221,206 @@ class Parser {
   };
 
   auto read_n(std::vector<char>& line, int n) -> bool {
-    line.clear();
-    for (int i = 0; i < n; ++i) {
-      if (it == buf.end()) {
-        return false;
-      }
-      line.push_back(*it);
-      ++it;
+    if (end - it < n) {
+      return false;
     }
+    line.assign(it, it + n);
+    it += n;
     return true;
   }
 
  private:
-  const std::vector<char> buf;
-  std::vector<char>::const_iterator it;
+  const char* begin;
+  const char* end;
+  const char* it;
 };
 
-class Serializer {
+using Slice = std::string_view;
+
+// a command frame parsed in place, argv points into the buffer the frame was
+// parsed from and stays valid as long as that buffer is not modified.
+struct Request {
+  Slice* argv = nullptr;
+  size_t argc = 0;
+  Slice frame;
+};
+
+// parses command frames (arrays of bulk strings) without copying anything:
+// the argv array of a Request comes from an Arena, so parsing never calls
+// malloc and argv lives until the arena is reset.
+class RequestParser {
  public:
-  static auto marshal(const Value& val) -> std::vector<char> {
-    if (val.type == types::ARRAY) {
-      return marshal_array(val);
+  static constexpr long long MAX_ARGS = 1024 * 1024;
+  static constexpr long long MAX_BULK = 512 * 1024 * 1024;
+  // the least an argument takes, "$0\r\n\r\n".
+  static constexpr long long MIN_ARG = 6;
+
+  // returns the size of the frame at the start of the buffer, or 0 when the
+  // frame is not complete yet.
+  static auto parse(const char* data, size_t size, Request& req,
+                    Arena& arena) -> size_t {
+    const char* p = data;
+    const char* end = data + size;
+
+    if (p == end) {
+      return 0;
     }
-    if (val.type == types::BULK) {
-      return marshal_bulk(val);
+    if (*p != types::ARRAY) {
+      throw std::runtime_error("protocol error, expected '*'.");
     }
-    if (val.type == types::STRING) {
-      return marshal_string(val);
+    ++p;
+    long long argc = 0;
+    if (!read_len(p, end, argc)) {
+      return 0;
     }
-    if (val.type == types::ERROR) {
-      return marshal_error(val);
+    if (argc <= 0 || argc > MAX_ARGS) {
+      throw std::runtime_error("protocol error, invalid multibulk length.");
     }
-    if (val.type == types::NIL) {
-      return marshal_null(val);
+    // argv is not allocated before the frame could be complete, a header
+    // alone must not cost its full size on every attempt.
+    if (end - p < argc * MIN_ARG) {
+      return 0;
+    }
+    Slice* argv = arena.make_array<Slice>(argc);
+
+    for (long long i = 0; i < argc; ++i) {
+      if (p == end) {
+        return 0;
+      }
+      if (*p != types::BULK) {
+        throw std::runtime_error("protocol error, expected '$'.");
+      }
+      ++p;
+      long long len = 0;
+      if (!read_len(p, end, len)) {
+        return 0;
+      }
+      if (len < 0 || len > MAX_BULK) {
+        throw std::runtime_error("protocol error, invalid bulk length.");
+      }
+      if (end - p < len + 2) {
+        return 0;
+      }
+      if (p[len] != '\r' || p[len + 1] != '\n') {
+        throw std::runtime_error("protocol error, bulk not terminated.");
+      }
+      argv[i] = Slice(p, len);
+      p += len + 2;
     }
-    return {};
+
+    req.argv = argv;
+    req.argc = argc;
+    req.frame = Slice(data, p - data);
+    return p - data;
   }
 
  private:
-  static auto marshal_array(const Value& val) -> std::vector<char> {
-    std::vector<char> res = {val.type};
-    std::string len(std::to_string(val.array.size()));
-    res.insert(res.end(), len.begin(), len.end());
-    res.push_back('\r');
-    res.push_back('\n');
-    for (auto& p : val.array) {
-      auto v = marshal(*p);
-      res.insert(res.end(), v.begin(), v.end());
+  // decodes the decimal length terminated by "\r\n" at p and moves p past it.
+  static auto read_len(const char*& p, const char* end, long long& len)
+      -> bool {
+    const char* q = p;
+    bool negative = false;
+    if (q != end && *q == '-') {
+      negative = true;
+      ++q;
+    }
+    long long n = 0;
+    const char* digits = q;
+    for (; q != end && *q >= '0' && *q <= '9'; ++q) {
+      n = n * 10 + (*q - '0');
+      if (n > MAX_BULK) {
+        throw std::runtime_error("protocol error, length out of range.");
+      }
     }
-    return res;
+    if (end - q < 2) {
+      return false;
+    }
+    if (q == digits || q[0] != '\r' || q[1] != '\n') {
+      throw std::runtime_error("protocol error, invalid length.");
+    }
+    len = negative ? -n : n;
+    p = q + 2;
+    return true;
   }
+};
 
-  static auto marshal_string(const Value& val) -> std::vector<char> {
-    std::vector<char> res = {val.type};
-    res.insert(res.end(), val.str.begin(), val.str.end());
-    res.push_back('\r');
-    res.push_back('\n');
-    return res;
+// writes resp values straight into a caller owned Buffer. lengths are
+// formatted by hand and constant replies are appended from shared encodings.
+class Serializer {
+ public:
+  static constexpr Slice OK = "+OK\r\n";
+  static constexpr Slice PONG = "+PONG\r\n";
+  static constexpr Slice NIL = "$-1\r\n";
+  static constexpr Slice EMPTY_BULK = "$0\r\n\r\n";
+  static constexpr Slice EMPTY_ARRAY = "*0\r\n";
+  static constexpr Slice ZERO = ":0\r\n";
+  static constexpr Slice ONE = ":1\r\n";
+
+  static void marshal(const Value& val, Buffer& out) {
+    if (val.type == types::ARRAY) {
+      array(out, val.array.size());
+      for (auto& p : val.array) {
+        marshal(*p, out);
+      }
+    } else if (val.type == types::BULK) {
+      bulk(out, Slice(val.bulk.data(), val.bulk.size()));
+    } else if (val.type == types::STRING) {
+      str(out, val.str);
+    } else if (val.type == types::ERROR) {
+      err(out, val.str);
+    } else if (val.type == types::INTEGER) {
+      integer(out, val.num);
+    } else if (val.type == types::NIL) {
+      out.append(NIL);
+    }
   }
 
-  static auto marshal_bulk(const Value& val) -> std::vector<char> {
-    std::vector<char> res = {val.type};
-    std::string len(std::to_string(val.bulk.size()));
-    res.insert(res.end(), len.begin(), len.end());
-    res.push_back('\r');
-    res.push_back('\n');
-    res.insert(res.end(), val.bulk.begin(), val.bulk.end());
-    res.push_back('\r');
-    res.push_back('\n');
-    return res;
+  static void str(Buffer& out, Slice s) {
+    out.append(types::STRING);
+    out.append(s);
+    out.append(CRLF);
   }
 
-  static auto marshal_error(const Value& val) -> std::vector<char> {
-    std::vector<char> res = {val.type};
-    res.insert(res.end(), val.str.begin(), val.str.end());
-    res.push_back('\r');
-    res.push_back('\n');
-    return res;
+  static void err(Buffer& out, Slice s) {
+    out.append(types::ERROR);
+    out.append(s);
+    out.append(CRLF);
   }
 
-  static auto marshal_null(const Value& val) -> std::vector<char> {
-    return {'$', '-', '1', '\r', '\n'};
+  static void integer(Buffer& out, long long n) { header(out, types::INTEGER, n); }
+
+  static void bulk(Buffer& out, Slice s) {
+    header(out, types::BULK, static_cast<long long>(s.size()));
+    out.append(s);
+    out.append(CRLF);
+  }
+
+  // the header of an array, its n elements follow.
+  static void array(Buffer& out, size_t n) {
+    header(out, types::ARRAY, static_cast<long long>(n));
+  }
+
+ private:
+  static constexpr Slice CRLF = "\r\n";
+
+  // type, decimal n and "\r\n" in a single append.
+  static void header(Buffer& out, char type, long long n) {
+    char buf[32];
+    char* end = buf + sizeof(buf);
+    char* p = end;
+    *--p = '\n';
+    *--p = '\r';
+    unsigned long long u = n < 0 ? 0ull - static_cast<unsigned long long>(n)
+                                 : static_cast<unsigned long long>(n);
+    do {
+      *--p = static_cast<char>('0' + u % 10);
+      u /= 10;
+    } while (u != 0);
+    if (n < 0) {
+      *--p = '-';
+    }
+    *--p = type;
+    out.append(p, end - p);
   }
 };
 };  // namespace resp
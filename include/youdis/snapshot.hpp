@@ -0,0 +1,439 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+#include "utils.hpp"
+#include "youdis/database.hpp"
+#include "youdis/eviction.hpp"
+#include "youdis/expiration.hpp"
+
+namespace resp {
+// a point in time dump of the dataset in a compact binary format:
+//
+//   "YOUDIS" version:u8 strings:u64 hashes:u64
+//   [DEADLINE at:u64] STRING key value |
+//   [DEADLINE at:u64] HASH key fields:u32 (field value)*  ...
+//   EOF checksum:u64
+//
+// strings are a u32 length followed by the bytes, numbers are little endian
+// and the checksum covers everything before it. DEADLINE gives the next key
+// its ttl in unix milliseconds, version 1 files have none.
+class Snapshot {
+ public:
+  static auto instance() -> Snapshot& {
+    static Snapshot snapshot;
+    return snapshot;
+  }
+
+  Snapshot(const Snapshot&) = delete;
+  Snapshot& operator=(const Snapshot&) = delete;
+
+  void init(const std::string& filepath_) { filepath = filepath_; }
+
+  // SAVE: dumps the dataset from the calling thread, holding every shard for
+  // reading meanwhile. returns false without saving while a BGSAVE child
+  // runs, and keeps one from starting until it is done.
+  auto save() -> bool {
+    std::lock_guard<std::mutex> guard(childMtx);
+    if (child != -1) {
+      return false;
+    }
+    Database::Guard all(~uint64_t(0), false);
+    return write(filepath);
+  }
+
+  // BGSAVE: dumps the dataset from a forked child, returns false when one is
+  // already running.
+  auto save_background() -> bool {
+    std::lock_guard<std::mutex> guard(childMtx);
+    if (child != -1) {
+      return false;
+    }
+    std::string path = filepath;
+    pid_t pid = Database::fork([]() {}, [&path]() { return write(path); });
+    if (pid == -1) {
+      error() << "failed to fork snapshot: " << strerror(errno) << std::endl;
+      return false;
+    }
+    child = pid;
+    info() << "background snapshot started by pid " << pid << std::endl;
+    return true;
+  }
+
+  auto saving() -> bool {
+    std::lock_guard<std::mutex> guard(childMtx);
+    return child != -1;
+  }
+
+  // periodic work: reaps a finished background save.
+  void cron() {
+    std::lock_guard<std::mutex> guard(childMtx);
+    int status = 0;
+    if (child == -1 || waitpid(child, &status, WNOHANG) != child) {
+      return;
+    }
+    pid_t pid = child;
+    child = -1;
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+      info() << "background snapshot saved to " << filepath << std::endl;
+    } else {
+      // a child killed halfway leaves its temporary file behind.
+      unlink((filepath + ".tmp." + std::to_string(pid)).c_str());
+      error() << "background snapshot failed" << std::endl;
+    }
+  }
+
+  // loads the snapshot into the empty database before any reactor runs,
+  // returns false when there is none.
+  auto load() -> bool {
+    int fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      return false;
+    }
+    struct stat st;
+    size_t len = fstat(fd, &st) == 0 ? st.st_size : 0;
+    void* mapped = len == 0 ? MAP_FAILED
+                            : mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+      throw std::runtime_error("failed to map snapshot " + filepath);
+    }
+    madvise(mapped, len, MADV_SEQUENTIAL);
+
+    auto start = std::chrono::steady_clock::now();
+    Reader reader(static_cast<const char*>(mapped), len);
+    try {
+      read(reader);
+    } catch (const std::exception& e) {
+      munmap(mapped, len);
+      throw std::runtime_error("bad snapshot " + filepath + ": " + e.what());
+    }
+    munmap(mapped, len);
+
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    info() << "loaded snapshot " << filepath << ": " << reader.keys
+           << " keys, " << len << " bytes in " << seconds << "s" << std::endl;
+    return true;
+  }
+
+ private:
+  static constexpr char MAGIC[] = "YOUDIS";
+  static constexpr size_t MAGIC_LEN = sizeof(MAGIC) - 1;
+  static constexpr uint8_t VERSION = 2;
+  static constexpr uint8_t STRING = 0;
+  static constexpr uint8_t HASH = 1;
+  static constexpr uint8_t DEADLINE = 2;
+  static constexpr uint8_t END = 0xff;
+  static constexpr size_t CHUNK = 1 << 20;
+
+  Snapshot() : child(-1) {}
+
+  // a 64 bit checksum fed 8 bytes at a time, however the input is split.
+  class Checksum {
+   public:
+    void update(const char* p, size_t n) {
+      for (; n > 0 && filled != 0; --n) {
+        push(*p++);
+      }
+      for (; n >= 8; n -= 8, p += 8) {
+        mix(load64(p));
+      }
+      for (; n > 0; --n) {
+        push(*p++);
+      }
+    }
+
+    auto value() const -> uint64_t {
+      uint64_t h = sum;
+      if (filled != 0) {
+        h = (h ^ word) * PRIME;
+      }
+      return h ^ (h >> 29);
+    }
+
+   private:
+    static constexpr uint64_t PRIME = 0x9e3779b97f4a7c15ull;
+
+    void push(char c) {
+      word |= uint64_t(static_cast<uint8_t>(c)) << (8 * filled);
+      if (++filled == 8) {
+        mix(word);
+        word = 0;
+        filled = 0;
+      }
+    }
+
+    void mix(uint64_t w) {
+      sum = (sum ^ w) * PRIME;
+      sum ^= sum >> 32;
+    }
+
+    uint64_t sum = 0;
+    uint64_t word = 0;
+    int filled = 0;
+  };
+
+  static auto load64(const char* p) -> uint64_t {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) {
+      v = (v << 8) | static_cast<uint8_t>(p[i]);
+    }
+    return v;
+  }
+
+  static auto load32(const char* p) -> uint32_t {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; --i) {
+      v = (v << 8) | static_cast<uint8_t>(p[i]);
+    }
+    return v;
+  }
+
+  // buffers the encoded dataset and writes it out a chunk at a time.
+  class Writer {
+   public:
+    Writer(int fd_) : fd(fd_), ok(true) {}
+
+    void u8(uint8_t v) { buf += static_cast<char>(v); }
+
+    void u32(uint32_t v) {
+      for (int i = 0; i < 4; ++i, v >>= 8) {
+        buf += static_cast<char>(v & 0xff);
+      }
+    }
+
+    void u64(uint64_t v) {
+      for (int i = 0; i < 8; ++i, v >>= 8) {
+        buf += static_cast<char>(v & 0xff);
+      }
+    }
+
+    void str(std::string_view s) {
+      u32(static_cast<uint32_t>(s.size()));
+      buf.append(s.data(), s.size());
+      if (buf.size() >= CHUNK) {
+        flush();
+      }
+    }
+
+    // writes the trailer, everything before it is covered by the checksum.
+    auto finish() -> bool {
+      u8(END);
+      flush();
+      u64(checksum.value());
+      write_out();
+      return ok;
+    }
+
+    void flush() {
+      checksum.update(buf.data(), buf.size());
+      write_out();
+    }
+
+   private:
+    void write_out() {
+      for (size_t done = 0; ok && done < buf.size();) {
+        ssize_t n = ::write(fd, buf.data() + done, buf.size() - done);
+        if (n == -1) {
+          ok = errno == EINTR;
+          continue;
+        }
+        done += n;
+      }
+      buf.clear();
+    }
+
+    int fd;
+    bool ok;
+    std::string buf;
+    Checksum checksum;
+  };
+
+  // bounds checked decoding over the mapped file.
+  struct Reader {
+    const char* data;
+    size_t len;
+    size_t pos = 0;
+    size_t keys = 0;
+
+    Reader(const char* data_, size_t len_) : data(data_), len(len_) {}
+
+    auto take(size_t n) -> const char* {
+      if (len - pos < n) {
+        throw std::runtime_error("unexpected end of file");
+      }
+      const char* p = data + pos;
+      pos += n;
+      return p;
+    }
+
+    auto u8() -> uint8_t { return static_cast<uint8_t>(*take(1)); }
+    auto u32() -> uint32_t { return load32(take(4)); }
+    auto u64() -> uint64_t { return load64(take(8)); }
+
+    auto str() -> std::string_view {
+      uint32_t n = u32();
+      return std::string_view(take(n), n);
+    }
+  };
+
+  // writes the dataset to path through a temporary file, so path always
+  // holds a complete snapshot. the caller keeps the dataset from changing.
+  // the temporary file is named after the writing process, so a child and
+  // its parent never write to the same one.
+  static auto write(const std::string& path) -> bool {
+    std::string temp = path + ".tmp." + std::to_string(getpid());
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+      return false;
+    }
+
+    uint64_t strings = 0;
+    uint64_t hashes = 0;
+    for (auto& shard : Database::shards()) {
+      strings += shard.sets.size();
+      hashes += shard.hsets.size();
+    }
+
+    Writer writer(fd);
+    for (size_t i = 0; i < MAGIC_LEN; ++i) {
+      writer.u8(MAGIC[i]);
+    }
+    writer.u8(VERSION);
+    writer.u64(strings);
+    writer.u64(hashes);
+    Object::Digits digits;
+    int64_t now = Database::now();
+    for (auto& shard : Database::shards()) {
+      // writes the deadline of a key ahead of it, false when it is past.
+      auto live = [&](const auto& entry) {
+        if (!entry.flag) {
+          return true;
+        }
+        int64_t at = *shard.expires.find(entry.key());
+        if (at <= now) {
+          return false;
+        }
+        writer.u8(DEADLINE);
+        writer.u64(static_cast<uint64_t>(at));
+        return true;
+      };
+      shard.sets.for_each_entry([&](const auto& entry) {
+        if (live(entry)) {
+          writer.u8(STRING);
+          writer.str(entry.key());
+          writer.str(entry.value.view(digits));
+        }
+      });
+      shard.hsets.for_each_entry([&](const auto& entry) {
+        if (!live(entry)) {
+          return;
+        }
+        writer.u8(HASH);
+        writer.str(entry.key());
+        writer.u32(static_cast<uint32_t>(entry.value.size()));
+        entry.value.for_each(
+            [&](std::string_view field, std::string_view value) {
+              writer.str(field);
+              writer.str(value);
+            });
+      });
+    }
+
+    bool ok = writer.finish() && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(temp.c_str(), path.c_str()) == -1) {
+      unlink(temp.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  static void read(Reader& reader) {
+    if (reader.len < MAGIC_LEN + 1 + 8 ||
+        memcmp(reader.take(MAGIC_LEN), MAGIC, MAGIC_LEN) != 0) {
+      throw std::runtime_error("not a snapshot");
+    }
+    uint8_t version = reader.u8();
+    if (version == 0 || version > VERSION) {
+      throw std::runtime_error("unsupported snapshot version");
+    }
+    Checksum checksum;
+    checksum.update(reader.data, reader.len - 8);
+    if (checksum.value() != load64(reader.data + reader.len - 8)) {
+      throw std::runtime_error("checksum mismatch");
+    }
+
+    // the shards get about the same share of the keys, size them up front
+    // so the load never rehashes.
+    uint64_t strings = reader.u64();
+    uint64_t hashes = reader.u64();
+    for (auto& shard : Database::shards()) {
+      shard.sets.reserve(strings / Database::SHARDS * 9 / 8);
+      shard.hsets.reserve(hashes / Database::SHARDS * 9 / 8);
+    }
+
+    int64_t now = Database::now();
+    while (true) {
+      uint8_t type = reader.u8();
+      if (type == END) {
+        break;
+      }
+      int64_t at = -1;
+      if (type == DEADLINE) {
+        at = static_cast<int64_t>(reader.u64());
+        type = reader.u8();
+      }
+      auto key = reader.str();
+      auto& shard = Database::shard(key);
+      if (type == STRING) {
+        auto value = reader.str();
+        auto e = shard.sets.insert_entry(key).first;
+        Eviction::instance().touch(e->clock, true);
+        e->value.assign(value);
+      } else if (type == HASH) {
+        auto e = shard.hsets.insert_entry(key).first;
+        Eviction::instance().touch(e->clock, true);
+        auto& hash = e->value;
+        uint32_t fields = reader.u32();
+        hash.reserve(fields);
+        for (uint32_t i = 0; i < fields; ++i) {
+          auto field = reader.str();
+          auto value = reader.str();
+          hash.set(field, value);
+        }
+      } else {
+        throw std::runtime_error("unknown record type");
+      }
+      // a key that expired while the server was down is dropped again.
+      if (at != -1 && at <= now) {
+        Database::erase(shard, key);
+        continue;
+      }
+      if (at != -1) {
+        Expiration::set(shard, key, at);
+      }
+      ++reader.keys;
+    }
+  }
+
+  std::string filepath;
+  pid_t child;
+  std::mutex childMtx;
+};
+};  // namespace resp
@@ -0,0 +1,183 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "youdis/config.hpp"
+
+// set by the build to the project version.
+#ifndef YOUDIS_VERSION
+#define YOUDIS_VERSION "unknown"
+#endif
+
+namespace resp {
+// runtime counters for INFO. every thread counts into a block of its own
+// that only it writes, with plain loads and stores that compile to ordinary
+// increments, and readers add the blocks up. the atomics only make the
+// concurrent reads well defined.
+class Stats {
+ public:
+  // the size of the per command arrays, at least the number of commands.
+  static constexpr size_t COMMANDS = 64;
+  // reading a clock costs more than a fast command, so only every
+  // TIME_EVERY-th call of a command is timed, starting with the first, and
+  // the time of the others is taken to be the average.
+  static constexpr uint64_t TIME_EVERY = 16;
+
+  struct alignas(64) Counters {
+    // per command, in the order of the command table.
+    std::array<std::atomic<uint64_t>, COMMANDS> calls{};
+    // the calls that were timed, and their time in ticks().
+    std::array<std::atomic<uint64_t>, COMMANDS> timed{};
+    std::array<std::atomic<uint64_t>, COMMANDS> ticks{};
+    std::atomic<uint64_t> accepted{0};
+    std::atomic<uint64_t> closed{0};
+    std::atomic<uint64_t> netInput{0};
+    std::atomic<uint64_t> netOutput{0};
+    // event loop iterations, the events or completions they handled and the
+    // time spent on them outside of waiting.
+    std::atomic<uint64_t> loops{0};
+    std::atomic<uint64_t> events{0};
+    std::atomic<uint64_t> busyNanos{0};
+    // io_uring_enter calls of the uring backend.
+    std::atomic<uint64_t> syscalls{0};
+  };
+
+  // the counters of the calling thread.
+  static auto local() -> Counters& {
+    thread_local Counters& c = instance().add();
+    return c;
+  }
+
+  // a clock for timing commands: the cpu's time stamp counter where there
+  // is one, about half the cost of reading steady_clock. to_nanos()
+  // converts.
+  static auto ticks() -> uint64_t {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+  }
+
+  // ticks in nanoseconds, at the rate the counter ran at since startup.
+  auto to_nanos(uint64_t n) const -> uint64_t {
+    auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now() - started)
+                     .count();
+    uint64_t elapsed = ticks() - startTicks;
+    return elapsed > 0 ? static_cast<uint64_t>(double(n) * nanos / elapsed)
+                       : 0;
+  }
+
+  // only ever called by the thread owning the counter.
+  static void bump(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+  }
+
+  static auto instance() -> Stats& {
+    static Stats stats;
+    return stats;
+  }
+
+  Stats(const Stats&) = delete;
+  Stats& operator=(const Stats&) = delete;
+
+  // the configuration the server runs with, for INFO to show.
+  void configure(const Config& config_) { cfg = config_; }
+  auto config() const -> const Config& { return cfg; }
+
+  // calls f(counters) for the counters of every thread so far.
+  template <class F>
+  void for_each(F&& f) {
+    std::lock_guard<std::mutex> guard(mtx);
+    for (auto& c : threads) {
+      f(static_cast<const Counters&>(*c));
+    }
+  }
+
+  // the sum of one counter over all threads.
+  auto total(std::atomic<uint64_t> Counters::*counter) -> uint64_t {
+    uint64_t sum = 0;
+    for_each([&](const Counters& c) {
+      sum += (c.*counter).load(std::memory_order_relaxed);
+    });
+    return sum;
+  }
+
+  auto commands() -> uint64_t {
+    uint64_t sum = 0;
+    for_each([&sum](const Counters& c) {
+      for (auto& n : c.calls) {
+        sum += n.load(std::memory_order_relaxed);
+      }
+    });
+    return sum;
+  }
+
+  // records the commands processed so far, called every cron interval so
+  // the recent rate can be told.
+  void sample(std::chrono::steady_clock::time_point now) {
+    uint64_t n = commands();
+    std::lock_guard<std::mutex> guard(mtx);
+    samples[next % SAMPLES] = Sample{now, n};
+    ++next;
+  }
+
+  // commands per second over the last SAMPLES samples.
+  auto ops_per_sec() -> uint64_t {
+    std::lock_guard<std::mutex> guard(mtx);
+    if (next < 2) {
+      return 0;
+    }
+    auto& last = samples[(next - 1) % SAMPLES];
+    auto& first = samples[next < SAMPLES ? 0 : next % SAMPLES];
+    double seconds =
+        std::chrono::duration<double>(last.at - first.at).count();
+    return seconds > 0 ? static_cast<uint64_t>((last.n - first.n) / seconds)
+                       : 0;
+  }
+
+  auto uptime() const -> std::chrono::seconds {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now() - started);
+  }
+
+ private:
+  static constexpr size_t SAMPLES = 16;
+
+  struct Sample {
+    std::chrono::steady_clock::time_point at;
+    uint64_t n = 0;
+  };
+
+  Stats() : started(std::chrono::steady_clock::now()), startTicks(ticks()) {}
+
+  auto add() -> Counters& {
+    std::lock_guard<std::mutex> guard(mtx);
+    threads.push_back(std::make_unique<Counters>());
+    return *threads.back();
+  }
+
+  Config cfg;
+  std::chrono::steady_clock::time_point started;
+  uint64_t startTicks;
+  std::mutex mtx;
+  // never removed, a thread's counts outlive it.
+  std::vector<std::unique_ptr<Counters>> threads;
+  std::array<Sample, SAMPLES> samples;
+  size_t next = 0;
+};
+};  // namespace resp
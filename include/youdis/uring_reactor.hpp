@@ -0,0 +1,257 @@
+#pragma once
+
+#include <sys/socket.h>
+
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "socket.hpp"
+#include "uring.hpp"
+#include "utils.hpp"
+#include "youdis/arena.hpp"
+#include "youdis/client.hpp"
+#include "youdis/config.hpp"
+#include "youdis/cron.hpp"
+#include "youdis/handle.hpp"
+#include "youdis/resp.hpp"
+#include "youdis/stats.hpp"
+
+namespace resp {
+// the reactor on io_uring instead of epoll. accepts and receives stay armed
+// as multishot requests reading into provided buffers, and the replies of an
+// iteration go out as sendmsg requests submitted together with the next
+// wait, so a busy loop makes one syscall per iteration instead of one per
+// read and write.
+class UringReactor {
+ public:
+  UringReactor(const Config& config, int id_)
+      : cron(id_, config.threads), queryLimit(config.clientQueryBufferLimit) {
+    server.create(AF_INET, SOCK_STREAM);
+    server.reuse_port();
+    server.bind_(config.bind.c_str(), config.port);
+    server.listen_(config.tcpBacklog);
+  }
+
+  UringReactor(const UringReactor&) = delete;
+  UringReactor& operator=(const UringReactor&) = delete;
+
+  // whether io_uring with everything this backend needs is available.
+  static auto supported() -> bool {
+    try {
+      Uring probe(8, BUFFER_GROUP, 8, 64);
+      return true;
+    } catch (const std::exception& e) {
+      error() << e.what() << std::endl;
+      return false;
+    }
+  }
+
+  void run() {
+    // the ring belongs to the thread that runs the loop, the kernel runs
+    // completion work only when this thread waits on it.
+    Uring uring(QUEUE_DEPTH, BUFFER_GROUP, BUFFER_COUNT, BUFFER_SIZE);
+    Request request;
+    Arena& arena = Arena::local();
+    auto& stats = Stats::local();
+
+    uring.accept_multishot(server.raw_fd(), tag(0, ACCEPT));
+    while (true) {
+      // submits the previous iteration's requests and sleeps no longer than
+      // until the next timer is due.
+      uring.submit_and_wait(cron.timeout());
+      auto start = std::chrono::steady_clock::now();
+      unsigned completions = uring.for_each_cqe([&](const io_uring_cqe& cqe) {
+        complete(uring, cqe, request, arena);
+      });
+      Stats::bump(stats.loops);
+      Stats::bump(stats.events, completions);
+
+      // group commit as in the epoll reactor: the aof is written before the
+      // replies are handed to the kernel.
+      Aof::instance().flush();
+      for (uint64_t id : pending) {
+        send(uring, id);
+      }
+      pending.clear();
+      // nothing parsed in this iteration is referenced anymore.
+      arena.reset();
+
+      cron.run();
+      Stats::bump(stats.busyNanos,
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count());
+      stats.syscalls.store(uring.syscalls(), std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  static constexpr unsigned QUEUE_DEPTH = 256;
+  static constexpr uint16_t BUFFER_GROUP = 0;
+  static constexpr unsigned BUFFER_COUNT = 1024;
+  static constexpr unsigned BUFFER_SIZE = 4096;
+  static constexpr int IOV_BATCH = 64;
+
+  // what a completion belongs to, kept in the low bits of its user data
+  // next to the connection id.
+  enum Op : uint64_t { ACCEPT, RECV, SEND, CANCEL };
+
+  struct Connection {
+    Connection(int fd, size_t queryLimit) : client(fd, queryLimit) {}
+
+    Client client;
+    // what the sendmsg in flight points at.
+    iovec iov[IOV_BATCH];
+    msghdr msg;
+    bool recving = false;
+    bool sending = false;
+    bool closing = false;
+  };
+
+  static auto tag(uint64_t id, Op op) -> uint64_t { return id << 2 | op; }
+
+  void complete(Uring& uring, const io_uring_cqe& cqe, Request& request,
+                Arena& arena) {
+    uint64_t id = cqe.user_data >> 2;
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    switch (static_cast<Op>(cqe.user_data & 3)) {
+      case ACCEPT:
+        if (cqe.res >= 0) {
+          accept(uring, cqe.res);
+        } else {
+          error() << "failed to accept client." << std::endl;
+        }
+        if (!more) {
+          uring.accept_multishot(server.raw_fd(), tag(0, ACCEPT));
+        }
+        return;
+      case RECV:
+        receive(uring, id, cqe, request, arena);
+        return;
+      case SEND:
+        sent(uring, id, cqe.res);
+        return;
+      case CANCEL:
+        return;
+    }
+  }
+
+  void accept(Uring& uring, int fd) {
+    uint64_t id = ++lastId;
+    auto& conn = connections.try_emplace(id, fd, queryLimit).first->second;
+    conn.recving = true;
+    uring.recv_multishot(fd, tag(id, RECV));
+    Stats::bump(Stats::local().accepted);
+  }
+
+  void receive(Uring& uring, uint64_t id, const io_uring_cqe& cqe,
+               Request& request, Arena& arena) {
+    auto it = connections.find(id);
+    auto& conn = it->second;
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+      uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+      if (cqe.res > 0 && !conn.closing) {
+        conn.client.feed(uring.buffer(bid), cqe.res);
+      }
+      uring.recycle(bid);
+    }
+
+    if (cqe.res > 0 && !conn.closing) {
+      try {
+        // drain every complete request, a trailing partial frame stays
+        // buffered until more arrives.
+        while (conn.client.next(request, arena)) {
+          Handler::handle(request, conn.client.output());
+        }
+        if (conn.client.overflowed()) {
+          throw std::runtime_error(
+              "closing client that reached the query buffer limit.");
+        }
+        pending.push_back(id);
+      } catch (const std::exception& e) {
+        error() << e.what() << std::endl;
+        close(uring, id);
+      }
+    } else if (cqe.res <= 0 && cqe.res != -ENOBUFS) {
+      // the peer went away or the socket failed.
+      close(uring, id);
+    }
+
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+      conn.recving = false;
+      // the multishot recv also ends when the provided buffers ran out,
+      // then it is armed again once some came back.
+      if (!conn.closing) {
+        conn.recving = true;
+        uring.recv_multishot(conn.client.raw_fd(), tag(id, RECV));
+      }
+    }
+    release(it);
+  }
+
+  // queues a sendmsg with what the client has pending, one at a time per
+  // connection so replies stay in order.
+  void send(Uring& uring, uint64_t id) {
+    auto it = connections.find(id);
+    if (it == connections.end()) {
+      return;
+    }
+    auto& conn = it->second;
+    if (conn.sending || conn.closing || !conn.client.pending()) {
+      return;
+    }
+    int count = conn.client.output().peek(conn.iov, IOV_BATCH);
+    memset(&conn.msg, 0, sizeof(conn.msg));
+    conn.msg.msg_iov = conn.iov;
+    conn.msg.msg_iovlen = count;
+    conn.sending = true;
+    uring.sendmsg(conn.client.raw_fd(), &conn.msg, tag(id, SEND));
+  }
+
+  void sent(Uring& uring, uint64_t id, int res) {
+    auto it = connections.find(id);
+    auto& conn = it->second;
+    conn.sending = false;
+    if (res < 0) {
+      close(uring, id);
+    } else {
+      conn.client.output().consume(res);
+      Stats::bump(Stats::local().netOutput, res);
+      send(uring, id);
+    }
+    release(it);
+  }
+
+  // stops the recv, the connection goes once nothing is in flight anymore.
+  void close(Uring& uring, uint64_t id) {
+    auto& conn = connections.at(id);
+    if (conn.closing) {
+      return;
+    }
+    conn.closing = true;
+    if (conn.recving) {
+      uring.cancel(tag(id, RECV), tag(id, CANCEL));
+    }
+  }
+
+  void release(std::unordered_map<uint64_t, Connection>::iterator it) {
+    auto& conn = it->second;
+    if (conn.closing && !conn.recving && !conn.sending) {
+      connections.erase(it);
+      Stats::bump(Stats::local().closed);
+    }
+  }
+
+  Cron cron;
+  size_t queryLimit;
+  Socket server;
+  std::unordered_map<uint64_t, Connection> connections;
+  uint64_t lastId = 0;
+  // connections with replies queued during the current iteration.
+  std::vector<uint64_t> pending;
+};
+};  // namespace resp
@@ -1,69 +1,107 @@
+#include <cerrno>
+#include <chrono>
+#include <csignal>
 #include <exception>
 #include <iostream>
 #include <memory>
-#include <mutex>
+#include <stdexcept>
 #include <thread>
+#include <vector>
 
-#include "epoll.hpp"
 #include "socket.hpp"
 #include "utils.hpp"
 #include "youdis/aof.hpp"
+#include "youdis/config.hpp"
+#include "youdis/eviction.hpp"
 #include "youdis/handle.hpp"
-#include "youdis/resp.hpp"
-#include "youdis/socket_readable.hpp"
+#include "youdis/hash.hpp"
+#include "youdis/reactor.hpp"
+#include "youdis/snapshot.hpp"
+#include "youdis/uring_reactor.hpp"
 
-int main(int argc, char** argv) {
-  try {
-    Socket server;
-    server.create(AF_INET, SOCK_STREAM);
-    server.reuse_port();
-    server.bind_("127.0.0.1", 6379);
-    server.listen_();
-    info() << "listening at 127.0.0.1:6379..." << std::endl;
+// binds of a busy port tried before giving up, 100ms apart.
+constexpr int PROBE_ATTEMPTS = 10;
 
-    Epoll epoll;
-    epoll.add_socket(server.raw_fd(), EPOLLIN);
-
-    std::vector<epoll_event> events(16);
-    std::unordered_map<int, std::pair<Socket, std::mutex>> clients;
+// starts one reactor per thread and runs the first on the calling thread.
+template <class R>
+void serve(const resp::Config& config) {
+  // the reactors share the port through SO_REUSEPORT, which would as well
+  // let them join the listeners of another server on it. a bind without
+  // the option fails while anyone listens there. the listener of a server
+  // that just exited can linger while the kernel tears down its io_uring,
+  // so the bind is retried for a moment.
+  for (int attempt = 1;; ++attempt) {
+    Socket probe;
+    probe.create(AF_INET, SOCK_STREAM);
+    probe.reuse_address();
+    try {
+      probe.bind_(config.bind.c_str(), config.port);
+      break;
+    } catch (const std::runtime_error& e) {
+      if (errno != EADDRINUSE || attempt == PROBE_ATTEMPTS) {
+        throw;
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  std::vector<std::unique_ptr<R>> reactors;
+  for (int i = 0; i < config.threads; ++i) {
+    reactors.push_back(std::make_unique<R>(config, i));
+  }
+  info() << "listening at " << config.bind << ":" << config.port << " with "
+         << config.threads << " threads on " << config.io << "..."
+         << std::endl;
 
-    while (true) {
-      int numEvents = epoll.wait(events, -1);
-      for (int i = 0; i < numEvents; ++i) {
-        int fd = events[i].data.fd;
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < reactors.size(); ++i) {
+    threads.emplace_back([&reactor = *reactors[i]]() {
+      try {
+        reactor.run();
+      } catch (const std::exception& e) {
+        error() << e.what() << std::endl;
+        std::terminate();
+      }
+    });
+  }
+  reactors[0]->run();
 
-        // connection
-        if (fd == server.raw_fd()) {
-          int cfd = server.accept_();
-          clients[cfd];
-          clients[cfd].first = Socket(cfd);
-          epoll.add_socket(cfd, EPOLLIN);
-          continue;
-        }
+  for (auto& t : threads) {
+    t.join();
+  }
+}
 
-        try {
-          std::unique_ptr<resp::Value> request;
-          {
-            std::lock_guard<std::mutex> guard(clients[fd].second);
-            resp::SocketReadable reader(clients[fd].first);
-            request = resp::GeneralParser(reader).parse();
-          }
-          auto response = resp::Handler::handle(std::move(request));
-          {
-            std::lock_guard<std::mutex> guard(clients[fd].second);
-            clients[fd].first.send_(response);
-          }
-        } catch (const resp::SocketClose& e) {
-          epoll.remove_socket(fd);
-          clients.erase(fd);
-        } catch (const std::exception& e) {
-          epoll.remove_socket(fd);
-          clients.erase(fd);
-          error() << e.what() << std::endl;
-        }
-      }
+int main(int argc, char** argv) {
+  try {
+    auto config = resp::Config::parse(argc, argv);
+    // a client going away mid-reply must not kill the server.
+    signal(SIGPIPE, SIG_IGN);
+    resp::Eviction::instance().configure(
+        config.maxmemory,
+        resp::Eviction::parse_policy(config.maxmemoryPolicy),
+        config.maxmemorySamples);
+    resp::Hash::configure(config.hashMaxListpackEntries,
+                          config.hashMaxListpackValue);
+    resp::Snapshot::instance().init(config.dbfilename);
+    if (config.appendonly) {
+      resp::Aof::instance().open(config.appendfilename,
+                                 resp::Aof::parse_fsync(config.appendfsync),
+                                 config.aofRewritePercentage,
+                                 config.aofRewriteMinSize);
+      resp::Aof::instance().load(resp::Handler::replay);
+    } else {
+      resp::Snapshot::instance().load();
     }
 
+    if (config.io == "uring" && !resp::UringReactor::supported()) {
+      info() << "io_uring is not available, using epoll." << std::endl;
+      config.io = "epoll";
+    }
+    resp::Stats::instance().configure(config);
+    if (config.io == "uring") {
+      serve<resp::UringReactor>(config);
+    } else {
+      serve<resp::Reactor>(config);
+    }
   } catch (const std::exception& e) {
     error() << e.what() << std::endl;
     return 1;
@@ -0,0 +1,253 @@
+#include <cctype>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "utils.hpp"
+#include "youdis/handle.hpp"
+#include "youdis/microbench.hpp"
+#include "youdis/random.hpp"
+#include "youdis/resp.hpp"
+
+namespace {
+using resp::Microbench;
+
+// serves GeneralParser a frame from memory, the way SocketReadable serves
+// it from a socket.
+class MemoryReadable : public resp::Readable {
+ public:
+  explicit MemoryReadable(const std::string& data_) : data(data_), it(0) {}
+
+  void rewind() { it = 0; }
+
+  auto readline(std::vector<char>& line) -> bool {
+    line.clear();
+    for (; it < data.size(); ++it) {
+      if (data[it] == '\n' && !line.empty() && line.back() == '\r') {
+        line.pop_back();
+        ++it;
+        return true;
+      }
+      line.push_back(data[it]);
+    }
+    return false;
+  }
+
+  auto readline() -> bool {
+    std::vector<char> line;
+    return readline(line);
+  }
+
+  auto read_byte(char& c) -> bool {
+    if (it == data.size()) {
+      return false;
+    }
+    c = data[it++];
+    return true;
+  }
+
+  auto read_n(std::vector<char>& buffer, int n) -> bool {
+    if (data.size() - it < size_t(n)) {
+      return false;
+    }
+    buffer.assign(data.begin() + it, data.begin() + it + n);
+    it += n;
+    return true;
+  }
+
+ private:
+  const std::string& data;
+  size_t it;
+};
+
+auto frame(const std::vector<std::string>& argv) -> std::string {
+  std::string s = "*" + std::to_string(argv.size()) + "\r\n";
+  for (auto& arg : argv) {
+    s += "$" + std::to_string(arg.size()) + "\r\n" + arg + "\r\n";
+  }
+  return s;
+}
+
+// fixed width keys, a four byte prefix and twelve digits, so a table of
+// them is one block.
+constexpr size_t KEY_LEN = 16;
+
+void key(char* out, const char* prefix, uint64_t n) {
+  std::memcpy(out, prefix, 4);
+  for (size_t i = KEY_LEN; i-- > 4; n /= 10) {
+    out[i] = static_cast<char>('0' + n % 10);
+  }
+}
+
+void parsers(Microbench& bench) {
+  auto set = frame({"SET", "key:000000000001", "xxx"});
+  std::string pipeline;
+  for (int i = 0; i < 16; ++i) {
+    pipeline += set;
+  }
+
+  MemoryReadable readable(set);
+  bench.run("parser/general/set", 1, [&]() {
+    readable.rewind();
+    resp::GeneralParser parser(readable);
+    resp::keep(parser.parse());
+  });
+  bench.run("parser/value/set", 1, [&]() {
+    resp::Parser parser(set.data(), set.size());
+    resp::keep(parser.parse());
+  });
+  bench.run("parser/value/pipeline16", 16, [&]() {
+    resp::Parser parser(pipeline.data(), pipeline.size());
+    for (int i = 0; i < 16; ++i) {
+      resp::keep(parser.parse());
+    }
+  });
+  auto& arena = resp::Arena::local();
+  bench.run("parser/request/set", 1, [&]() {
+    resp::Request req;
+    resp::keep(resp::RequestParser::parse(set.data(), set.size(), req, arena));
+    arena.reset();
+  });
+  bench.run("parser/request/pipeline16", 16, [&]() {
+    resp::Request req;
+    size_t pos = 0;
+    while (pos < pipeline.size()) {
+      pos += resp::RequestParser::parse(pipeline.data() + pos,
+                                        pipeline.size() - pos, req, arena);
+    }
+    arena.reset();
+  });
+}
+
+void serializers(Microbench& bench) {
+  resp::Buffer out;
+  for (size_t size : {16, 4096}) {
+    auto value = resp::Value::make_bulk(std::vector<char>(size, 'x'));
+    bench.run("serializer/marshal/bulk" + std::to_string(size), 1, [&]() {
+      resp::Serializer::marshal(*value, out);
+      out.clear();
+    });
+  }
+  for (size_t n : {16, 1024}) {
+    std::vector<std::unique_ptr<resp::Value>> elements;
+    for (size_t i = 0; i < n; ++i) {
+      elements.push_back(resp::Value::make_bulk(std::vector<char>(16, 'x')));
+    }
+    auto array = resp::Value::make_array(std::move(elements));
+    bench.run("serializer/marshal/array" + std::to_string(n), 1, [&]() {
+      resp::Serializer::marshal(*array, out);
+      out.clear();
+    });
+  }
+  std::string value(16, 'x');
+  bench.run("serializer/bulk16", 1, [&]() {
+    resp::Serializer::bulk(out, value);
+    out.clear();
+  });
+}
+
+void dispatch(Microbench& bench) {
+  const resp::Slice names[] = {"GET",  "set",    "HGETALL", "mget",
+                               "PING", "hset",   "EXPIRE",  "scan"};
+  bench.run("dispatch/lookup", 8, [&]() {
+    for (auto name : names) {
+      resp::keep(resp::Command::lookup(name));
+    }
+  });
+
+  // whole requests through Handler, from the parsed frame to the reply.
+  resp::Buffer out;
+  auto& arena = resp::Arena::local();
+  for (auto& argv : std::vector<std::vector<std::string>>{
+           {"SET", "key:000000000001", "xxx"},
+           {"GET", "key:000000000001"},
+           {"PING"}}) {
+    auto f = frame(argv);
+    resp::Request req;
+    resp::RequestParser::parse(f.data(), f.size(), req, arena);
+    std::string name = argv[0];
+    for (auto& c : name) {
+      c = static_cast<char>(tolower(c));
+    }
+    bench.run("dispatch/handle/" + name, 1, [&]() {
+      resp::Handler::handle(req, out);
+      out.clear();
+    });
+    arena.reset();
+  }
+  for (auto& shard : resp::Database::shards()) {
+    shard.sets.clear();
+  }
+}
+
+// string keys through the sharded dicts as commands see them, at n keys.
+void database(Microbench& bench, uint64_t n) {
+  std::string prefix = "database/" + std::to_string(n) + "/";
+  bool any = false;
+  for (auto name : {"insert", "find-hit", "find-miss", "erase"}) {
+    any = any || bench.enabled(prefix + name);
+  }
+  // the keys alone take a while to build at 10M.
+  if (!any) {
+    return;
+  }
+  std::vector<char> keys(n * KEY_LEN);
+  for (uint64_t i = 0; i < n; ++i) {
+    key(&keys[i * KEY_LEN], "key:", i);
+  }
+  auto at = [&keys](uint64_t i) {
+    return resp::Slice(&keys[i * KEY_LEN], KEY_LEN);
+  };
+
+  bench.once(prefix + "insert", n, [&]() {
+    for (uint64_t i = 0; i < n; ++i) {
+      auto k = at(i);
+      resp::Database::shard(k).sets.insert(k).first->assign("xxx");
+    }
+  });
+  // random keys defeat the caches the way a real keyspace does.
+  constexpr size_t BATCH = 1024;
+  bench.run(prefix + "find-hit", BATCH, [&]() {
+    for (size_t i = 0; i < BATCH; ++i) {
+      auto k = at(resp::random64() % n);
+      resp::keep(resp::Database::shard(k).sets.find(k));
+    }
+  });
+  std::vector<char> misses(BATCH * KEY_LEN);
+  for (size_t i = 0; i < BATCH; ++i) {
+    key(&misses[i * KEY_LEN], "not:", i);
+  }
+  bench.run(prefix + "find-miss", BATCH, [&]() {
+    for (size_t i = 0; i < BATCH; ++i) {
+      resp::Slice k(&misses[i * KEY_LEN], KEY_LEN);
+      resp::keep(resp::Database::shard(k).sets.find(k));
+    }
+  });
+  bench.once(prefix + "erase", n, [&]() {
+    for (uint64_t i = 0; i < n; ++i) {
+      auto k = at(i);
+      resp::Database::shard(k).sets.erase(k);
+    }
+  });
+}
+}  // namespace
+
+// times the hot paths in isolation and prints a csv or json line per case.
+int main(int argc, char** argv) {
+  try {
+    auto config = resp::MicrobenchConfig::parse(argc, argv);
+    Microbench bench(config);
+    parsers(bench);
+    serializers(bench);
+    dispatch(bench);
+    for (auto n : config.sizes) {
+      database(bench, n);
+    }
+  } catch (const std::exception& e) {
+    error() << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}